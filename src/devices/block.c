@@ -1,10 +1,92 @@
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
 #include <list.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Most sectors that merging may combine into one transfer. */
+#define BLOCK_MERGE_MAX 128
+
+/* How long the deadline scheduler lets a request wait, in timer
+   ticks, before serving it ahead of sector order. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* Number of power-of-two latency buckets per histogram.  Bucket
+   I counts requests that took less than 2**(I+1) TSC cycles. */
+#define LATENCY_BUCKETS 40
+
+/* Number of recent requests kept in each device's trace. */
+#define TRACE_SIZE 64
+
+/* Print latency statistics at shutdown? */
+bool block_iostat;
+
+/* Request classes with separate latency histograms. */
+enum io_class
+{
+  IO_READ_SEQ,   /* Sequential read. */
+  IO_READ_RAND,  /* Random read. */
+  IO_WRITE_SEQ,  /* Sequential write. */
+  IO_WRITE_RAND, /* Random write. */
+  IO_CLASS_CNT
+};
+
+/* A completed request, as recorded in a device's trace. */
+struct block_trace
+{
+  block_sector_t sector; /* First sector. */
+  block_sector_t cnt;    /* Number of sectors. */
+  bool write;            /* Direction. */
+  tid_t issuer;          /* Submitting thread. */
+  uint64_t latency;      /* TSC cycles from submission to completion. */
+};
+
+/* Per-device I/O statistics, protected by the device's queue
+   lock. */
+struct block_stats
+{
+  unsigned long long latency[IO_CLASS_CNT][LATENCY_BUCKETS];
+  block_sector_t next_sector;    /* Sector after the last submission. */
+  unsigned in_flight;            /* Submitted but not completed. */
+  unsigned max_depth;            /* Largest IN_FLIGHT seen. */
+  unsigned long long depth_sum;  /* Sum of sampled depths. */
+  unsigned long long depth_cnt;  /* Number of samples. */
+  struct block_trace trace[TRACE_SIZE]; /* Ring of recent requests. */
+  unsigned long long trace_cnt;  /* Requests ever traced. */
+};
+
+struct block_queue;
+
+/* An I/O scheduler: picks, without removing it, the request that
+   should be dispatched next from a nonempty queue. */
+struct block_scheduler
+{
+  const char *name;
+  struct block_request *(*next) (struct block_queue *);
+};
+
+/* A request queue, served by one worker thread.  Block devices
+   that cannot transfer concurrently, such as the two disks on
+   one IDE channel, may share a queue. */
+struct block_queue
+{
+  char name[20];                       /* Worker thread name. */
+  struct lock lock;                    /* Protects the members below. */
+  struct condition not_empty;          /* Signaled on submission. */
+  struct list requests;                /* Pending requests, oldest first. */
+  struct list fifo[2];                 /* Pending reads, writes, oldest
+                                          first. */
+  const struct block_scheduler *sched; /* I/O scheduler. */
+  block_sector_t head;                 /* Sector after the last dispatch. */
+  bool ascending;                      /* Elevator sweep direction. */
+  bool started;                        /* Worker thread created? */
+};
+
 /* A block device. */
 struct block
 {
@@ -19,6 +101,9 @@ struct block
 
   unsigned long long read_cnt;  /* Number of sectors read. */
   unsigned long long write_cnt; /* Number of sectors written. */
+
+  struct block_queue *queue; /* Pending requests, maybe shared. */
+  struct block_stats *stats; /* Latency and queue statistics. */
 };
 
 /* List of all block devices. */
@@ -29,6 +114,34 @@ static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
 
+static struct block_request *noop_next (struct block_queue *);
+static struct block_request *deadline_next (struct block_queue *);
+static struct block_request *elevator_next (struct block_queue *);
+
+/* Available I/O schedulers. */
+static const struct block_scheduler schedulers[] = {
+  { "noop", noop_next },
+  { "deadline", deadline_next },
+  { "elevator", elevator_next },
+};
+#define SCHEDULER_CNT (sizeof schedulers / sizeof *schedulers)
+
+/* Scheduler given to newly registered block devices. */
+static const struct block_scheduler *default_scheduler = &schedulers[1];
+
+static void block_worker (void *queue_);
+static void account_submit (struct block_stats *, struct block_request *);
+static void account_complete (struct block_stats *, struct block_request *);
+
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
 /* Returns a human-readable name for the given block device
    TYPE. */
 const char *
@@ -115,9 +228,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -128,10 +239,510 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR are all valid
+   offsets within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  ASSERT (cnt > 0);
   check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  if (cnt > block->size - sector)
+    check_sector (block, block->size);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses the driver's multi-sector transfer when it has
+   one, so that the whole range costs few device commands.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer)
+{
+  struct block_request r;
+  block_request_init (&r, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer)
+{
+  struct block_request r;
+  block_request_init (&r, true, sector, cnt, (void *)buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to transfer CNT sectors starting at
+   SECTOR between a device and BUFFER, writing to the device if
+   WRITE is true.  COMPLETE, if non-null, is called with R and AUX
+   once the transfer is done. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, block_sector_t cnt, void *buffer,
+                    block_complete_func *complete, void *aux)
+{
+  r->block = NULL;
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->deadline = 0;
+  r->issued = 0;
+  r->sequential = false;
+  r->issuer = TID_ERROR;
+  r->complete = complete;
+  r->aux = aux;
+  sema_init (&r->done, 0);
+}
+
+/* Queues request R on BLOCK and returns without waiting for it.
+   Requests on stacked devices are queued on the device at the
+   bottom of the stack.  R must stay valid until it completes. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  struct block_queue *q;
+  bool start;
+
+  for (;;)
+    {
+      check_sectors (block, r->sector, r->cnt);
+      if (r->write)
+        {
+          ASSERT (block->type != BLOCK_FOREIGN);
+          block->write_cnt += r->cnt;
+        }
+      else
+        block->read_cnt += r->cnt;
+
+      if (block->ops->remap == NULL)
+        break;
+      block = block->ops->remap (block->aux, &r->sector);
+    }
+
+  r->block = block;
+  q = block->queue;
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  r->issuer = thread_current ()->tid;
+
+  lock_acquire (&q->lock);
+  account_submit (block->stats, r);
+  list_push_back (&q->requests, &r->elem);
+  list_push_back (&q->fifo[r->write], &r->fifo_elem);
+  cond_signal (&q->not_empty, &q->lock);
+  start = !q->started;
+  q->started = true;
+  lock_release (&q->lock);
+
+  /* Start the queue's worker thread on first use. */
+  if (start && thread_create (q->name, PRI_MAX, block_worker, q) == TID_ERROR)
+    PANIC ("%s: cannot start block worker thread", q->name);
+}
+
+/* Classifies request R, about to be queued, as sequential or
+   random and samples the queue depth of its device, whose
+   statistics are STATS.  The device's queue must be locked. */
+static void
+account_submit (struct block_stats *stats, struct block_request *r)
+{
+  r->sequential = r->sector == stats->next_sector;
+  stats->next_sector = r->sector + r->cnt;
+
+  stats->in_flight++;
+  if (stats->in_flight > stats->max_depth)
+    stats->max_depth = stats->in_flight;
+  stats->depth_sum += stats->in_flight;
+  stats->depth_cnt++;
+  r->issued = rdtsc ();
+}
+
+/* Records the latency of completed request R in STATS and adds R
+   to the trace.  The device's queue must be locked. */
+static void
+account_complete (struct block_stats *stats, struct block_request *r)
+{
+  uint64_t latency = rdtsc () - r->issued;
+  enum io_class class;
+  struct block_trace *t;
+  int bucket;
+
+  class = r->write ? (r->sequential ? IO_WRITE_SEQ : IO_WRITE_RAND)
+                   : (r->sequential ? IO_READ_SEQ : IO_READ_RAND);
+  for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+    if (latency >> (bucket + 1) == 0)
+      break;
+  stats->latency[class][bucket]++;
+  stats->in_flight--;
+
+  t = &stats->trace[stats->trace_cnt++ % TRACE_SIZE];
+  t->sector = r->sector;
+  t->cnt = r->cnt;
+  t->write = r->write;
+  t->issuer = r->issuer;
+  t->latency = latency;
+}
+
+/* Waits for request R, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Looks up the scheduler called NAME. */
+static const struct block_scheduler *
+find_scheduler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < SCHEDULER_CNT; i++)
+    if (!strcmp (schedulers[i].name, name))
+      return &schedulers[i];
+  return NULL;
+}
+
+/* Makes BLOCK's queue use the I/O scheduler called NAME.
+   Returns false if there is no such scheduler. */
+bool
+block_set_scheduler (struct block *block, const char *name)
+{
+  const struct block_scheduler *sched = find_scheduler (name);
+  if (sched == NULL)
+    return false;
+
+  lock_acquire (&block->queue->lock);
+  block->queue->sched = sched;
+  lock_release (&block->queue->lock);
+  return true;
+}
+
+/* Makes BLOCK queue its requests on the queue of WITH, so that a
+   single worker thread serves both devices.  Meant for devices
+   that share a controller and cannot transfer concurrently.
+   Must be called before any request is submitted to BLOCK. */
+void
+block_share_queue (struct block *block, struct block *with)
+{
+  struct block_queue *old = block->queue;
+
+  ASSERT (!old->started && list_empty (&old->requests));
+  if (old == with->queue)
+    return;
+  block->queue = with->queue;
+  free (old);
+}
+
+/* Makes block devices registered from now on use the I/O
+   scheduler called NAME.  Returns false if there is no such
+   scheduler. */
+bool
+block_set_default_scheduler (const char *name)
+{
+  const struct block_scheduler *sched = find_scheduler (name);
+  if (sched == NULL)
+    return false;
+  default_scheduler = sched;
+  return true;
+}
+
+/* Removes R from its queue, which must be locked. */
+static void
+queue_remove (struct block_request *r)
+{
+  list_remove (&r->elem);
+  list_remove (&r->fifo_elem);
+}
+
+/* noop: dispatches requests in arrival order. */
+static struct block_request *
+noop_next (struct block_queue *q)
+{
+  return list_entry (list_front (&q->requests), struct block_request, elem);
+}
+
+/* Returns the queued request with the lowest sector at or after
+   SECTOR, or a null pointer if there is none. */
+static struct block_request *
+lowest_at_or_after (struct block_queue *q, block_sector_t sector)
+{
+  struct block_request *best = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= sector && (best == NULL || r->sector < best->sector))
+        best = r;
+    }
+  return best;
+}
+
+/* Returns the queued request with the highest sector at or
+   before SECTOR, or a null pointer if there is none. */
+static struct block_request *
+highest_at_or_before (struct block_queue *q, block_sector_t sector)
+{
+  struct block_request *best = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector <= sector && (best == NULL || r->sector > best->sector))
+        best = r;
+    }
+  return best;
+}
+
+/* Returns the oldest queued read, if WRITE is false, or write,
+   if WRITE is true, if it has waited past its deadline, otherwise
+   a null pointer. */
+static struct block_request *
+expired (struct block_queue *q, bool write)
+{
+  struct block_request *oldest;
+
+  if (list_empty (&q->fifo[write]))
+    return NULL;
+  oldest = list_entry (list_front (&q->fifo[write]), struct block_request,
+                       fifo_elem);
+  return oldest->deadline <= timer_ticks () ? oldest : NULL;
+}
+
+/* deadline: serves the oldest read or write once it has waited
+   past its deadline, reads expiring sooner than writes and served
+   first.  Reads and writes are kept in separate FIFOs, so an
+   expired read is found even behind newer writes.  Otherwise
+   sweeps upward in sector order (C-LOOK), wrapping around to the
+   lowest sector at the end. */
+static struct block_request *
+deadline_next (struct block_queue *q)
+{
+  struct block_request *r;
+
+  r = expired (q, false);
+  if (r == NULL)
+    r = expired (q, true);
+  if (r != NULL)
+    return r;
+
+  r = lowest_at_or_after (q, q->head);
+  return r != NULL ? r : lowest_at_or_after (q, 0);
+}
+
+/* elevator: sweeps up and down the disk (SCAN), reversing when
+   there is no request left in the current direction. */
+static struct block_request *
+elevator_next (struct block_queue *q)
+{
+  struct block_request *r;
+
+  r = q->ascending ? lowest_at_or_after (q, q->head)
+                   : highest_at_or_before (q, q->head);
+  if (r == NULL)
+    {
+      q->ascending = !q->ascending;
+      r = q->ascending ? lowest_at_or_after (q, q->head)
+                       : highest_at_or_before (q, q->head);
+    }
+  return r;
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER with BLOCK's driver, in as few commands as the driver
+   allows. */
+static void
+block_transfer (struct block *block, bool write, block_sector_t sector,
+                block_sector_t cnt, uint8_t *buffer)
+{
+  block_sector_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Moves the queued requests of Q that have the same device and
+   direction as the requests in BATCH and extend the run of
+   sectors [*START, *END) at either end into BATCH, keeping BATCH
+   in sector order.  Q must be locked. */
+static void
+merge_requests (struct block_queue *q, struct list *batch,
+                block_sector_t *start, block_sector_t *end)
+{
+  struct block_request *first
+      = list_entry (list_front (batch), struct block_request, elem);
+  bool merged;
+
+  do
+    {
+      struct list_elem *e;
+
+      merged = false;
+      for (e = list_begin (&q->requests); e != list_end (&q->requests);
+           e = list_next (e))
+        {
+          struct block_request *r
+              = list_entry (e, struct block_request, elem);
+          if (r->block != first->block || r->write != first->write
+              || *end - *start + r->cnt > BLOCK_MERGE_MAX)
+            continue;
+
+          if (r->sector == *end)
+            {
+              queue_remove (r);
+              list_push_back (batch, e);
+              *end += r->cnt;
+              merged = true;
+              break;
+            }
+          else if (r->sector + r->cnt == *start)
+            {
+              queue_remove (r);
+              list_push_front (batch, e);
+              *start = r->sector;
+              merged = true;
+              break;
+            }
+        }
+    }
+  while (merged);
+}
+
+/* Carries out the requests in BATCH, which cover the CNT sectors
+   starting at START of one device in order.  Several requests go
+   to the driver as a single transfer through a bounce buffer. */
+static void
+dispatch_batch (struct list *batch, block_sector_t start, block_sector_t cnt)
+{
+  struct block_request *first
+      = list_entry (list_front (batch), struct block_request, elem);
+  struct block *block = first->block;
+  uint8_t *bounce = NULL;
+  struct list_elem *e;
+  size_t ofs;
+
+  if (list_next (&first->elem) != list_end (batch))
+    bounce = malloc (cnt * BLOCK_SECTOR_SIZE);
+
+  if (bounce == NULL)
+    {
+      /* A single request, or no memory to merge: one transfer
+         per request. */
+      for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+        {
+          struct block_request *r
+              = list_entry (e, struct block_request, elem);
+          block_transfer (block, r->write, r->sector, r->cnt, r->buffer);
+        }
+      return;
+    }
+
+  if (first->write)
+    for (e = list_begin (batch), ofs = 0; e != list_end (batch);
+         e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        memcpy (bounce + ofs, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+        ofs += r->cnt * BLOCK_SECTOR_SIZE;
+      }
+
+  block_transfer (block, first->write, start, cnt, bounce);
+
+  if (!first->write)
+    for (e = list_begin (batch), ofs = 0; e != list_end (batch);
+         e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        memcpy (r->buffer, bounce + ofs, r->cnt * BLOCK_SECTOR_SIZE);
+        ofs += r->cnt * BLOCK_SECTOR_SIZE;
+      }
+  free (bounce);
+}
+
+/* Worker thread for request queue QUEUE_.  Repeatedly takes the
+   request chosen by the queue's scheduler, merges adjacent
+   requests into it, performs the transfer and completes the
+   requests. */
+static void
+block_worker (void *queue_)
+{
+  struct block_queue *q = queue_;
+
+  for (;;)
+    {
+      struct block_request *r;
+      struct list batch;
+      struct list_elem *e;
+      block_sector_t start, end;
+
+      lock_acquire (&q->lock);
+      while (list_empty (&q->requests))
+        cond_wait (&q->not_empty, &q->lock);
+
+      r = q->sched->next (q);
+      queue_remove (r);
+      list_init (&batch);
+      list_push_back (&batch, &r->elem);
+      start = r->sector;
+      end = r->sector + r->cnt;
+      merge_requests (q, &batch, &start, &end);
+      q->head = end;
+      lock_release (&q->lock);
+
+      dispatch_batch (&batch, start, end - start);
+
+      lock_acquire (&q->lock);
+      for (e = list_begin (&batch); e != list_end (&batch); e = list_next (e))
+        {
+          r = list_entry (e, struct block_request, elem);
+          account_complete (r->block->stats, r);
+        }
+      lock_release (&q->lock);
+
+      while (!list_empty (&batch))
+        {
+          r = list_entry (list_pop_front (&batch), struct block_request,
+                          elem);
+          if (r->complete != NULL)
+            r->complete (r, r->aux);
+          else
+            sema_up (&r->done);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -155,10 +766,112 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Destination of formatted statistics: the console if BUF is
+   null, otherwise the SIZE-byte buffer BUF.  LEN counts every
+   byte produced, even those that did not fit. */
+struct stats_out
+{
+  char *buf;
+  size_t size;
+  size_t len;
+};
+
+/* Appends FORMAT to OUT, printf()-style. */
+static void PRINTF_FORMAT (2, 3)
+stats_printf (struct stats_out *out, const char *format, ...)
+{
+  va_list args;
+  int n;
+
+  va_start (args, format);
+  if (out->buf == NULL)
+    n = vprintf (format, args);
+  else
+    n = vsnprintf (out->buf + (out->len < out->size ? out->len : out->size),
+                   out->len < out->size ? out->size - out->len : 0, format,
+                   args);
+  va_end (args);
+  out->len += n;
+}
+
+/* Writes the latency histograms, queue depth and trace of BLOCK
+   to OUT.  Prints nothing for a device that served no requests,
+   such as a partition, whose requests are accounted to the disk
+   holding it. */
+static void
+format_stats (struct block *block, struct stats_out *out)
+{
+  static const char *class_names[IO_CLASS_CNT] = {
+    "seq read", "rand read", "seq write", "rand write",
+  };
+  struct block_stats *stats = block->stats;
+  unsigned long long avg;
+  int class, bucket;
+  size_t i, n;
+
+  if (stats->trace_cnt == 0)
+    return;
+
+  avg = stats->depth_sum * 100 / stats->depth_cnt;
+  stats_printf (out, "%s: queue depth: avg %llu.%02llu, max %u\n",
+                block->name, avg / 100, avg % 100, stats->max_depth);
+
+  stats_printf (out, "%s: latency (TSC cycles < 2^N: requests):\n",
+                block->name);
+  for (class = 0; class < IO_CLASS_CNT; class++)
+    {
+      unsigned long long total = 0;
+      for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        total += stats->latency[class][bucket];
+      if (total == 0)
+        continue;
+
+      stats_printf (out, "  %-10s %6llu:", class_names[class], total);
+      for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        if (stats->latency[class][bucket] != 0)
+          stats_printf (out, " %d:%llu", bucket + 1,
+                        stats->latency[class][bucket]);
+      stats_printf (out, "\n");
+    }
+
+  n = stats->trace_cnt < TRACE_SIZE ? stats->trace_cnt : TRACE_SIZE;
+  stats_printf (out, "%s: last %zu requests:\n", block->name, n);
+  for (i = stats->trace_cnt - n; i < stats->trace_cnt; i++)
+    {
+      struct block_trace *t = &stats->trace[i % TRACE_SIZE];
+      stats_printf (out,
+                    "  %c sector %" PRDSNu " +%" PRDSNu ", tid %d, "
+                    "%llu cycles\n",
+                    t->write ? 'W' : 'R', t->sector, t->cnt, t->issuer,
+                    (unsigned long long)t->latency);
+    }
+}
+
+/* Formats the I/O statistics of BLOCK into BUF, which has room
+   for SIZE bytes, truncating them if needed.  Like snprintf(),
+   returns the length of the full text, and null-terminates BUF
+   if SIZE is nonzero. */
+size_t
+block_format_stats (struct block *block, char *buf, size_t size)
+{
+  struct block_queue *q = block->queue;
+  struct stats_out out = { buf, size, 0 };
+
+  if (size > 0)
+    buf[0] = '\0';
+  lock_acquire (&q->lock);
+  format_stats (block, &out);
+  lock_release (&q->lock);
+  return out.len;
+}
+
+/* Prints statistics for each block device used for a Pintos role
+   and, if block_iostat is true, the latency statistics of every
+   block device. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -171,6 +884,17 @@ block_print_stats (void)
                   block->write_cnt);
         }
     }
+
+  if (!block_iostat)
+    return;
+
+  /* May run on panic, so the queue locks are not taken. */
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct stats_out out = { NULL, 0, 0 };
+      format_stats (list_entry (e, struct block, list_elem), &out);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -196,6 +920,25 @@ block_register (const char *name, enum block_type type, const char *extra_info,
   block->read_cnt = 0;
   block->write_cnt = 0;
 
+  block->stats = calloc (1, sizeof *block->stats);
+  if (block->stats == NULL)
+    PANIC ("Failed to allocate memory for block device statistics");
+  block->stats->next_sector = INVALID_SECTOR;
+
+  block->queue = malloc (sizeof *block->queue);
+  if (block->queue == NULL)
+    PANIC ("Failed to allocate memory for block device queue");
+  snprintf (block->queue->name, sizeof block->queue->name, "blk-%s", name);
+  lock_init (&block->queue->lock);
+  cond_init (&block->queue->not_empty);
+  list_init (&block->queue->requests);
+  list_init (&block->queue->fifo[0]);
+  list_init (&block->queue->fifo[1]);
+  block->queue->sched = default_scheduler;
+  block->queue->head = 0;
+  block->queue->ascending = true;
+  block->queue->started = false;
+
   printf ("%s: %'" PRDSNu " sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t)block->size * BLOCK_SECTOR_SIZE);
   printf (")");
@@ -1,7 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /* Size of a block device sector in bytes.
@@ -55,11 +59,64 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
-/* Statistics. */
+/* Asynchronous requests.
+
+   A request moves CNT consecutive sectors starting at SECTOR
+   between the device and BUFFER.  block_submit() queues it on the
+   device and returns at once; a per-device worker thread later
+   dispatches it in the order chosen by the device's I/O
+   scheduler, merging it with queued requests for adjacent
+   sectors.  On completion, COMPLETE is called from the worker
+   thread, if it is non-null; otherwise block_wait() returns.
+   Requests for overlapping sectors may be reordered, so a caller
+   must wait for a write to complete before reading the same
+   sectors back. */
+struct block_request;
+typedef void block_complete_func (struct block_request *, void *aux);
+
+struct block_request
+{
+  struct list_elem elem;     /* Element in a device queue. */
+  struct list_elem fifo_elem; /* Element in the queue's FIFO for WRITE. */
+  struct block *block;       /* Device the request was queued on. */
+  bool write;                /* Direction: true to write to the device. */
+  block_sector_t sector;     /* First sector. */
+  block_sector_t cnt;        /* Number of sectors. */
+  void *buffer;              /* CNT * BLOCK_SECTOR_SIZE bytes. */
+  int64_t deadline;          /* Timer tick by which to dispatch. */
+  uint64_t issued;           /* TSC value at submission. */
+  bool sequential;           /* Continues the previous request? */
+  tid_t issuer;              /* Submitting thread. */
+  block_complete_func *complete; /* Completion callback, or null. */
+  void *aux;                 /* Passed to COMPLETE. */
+  struct semaphore done;     /* Up'd on completion if COMPLETE is null. */
+};
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t sector, block_sector_t cnt,
+                         void *buffer, block_complete_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
+/* I/O schedulers: "noop", "deadline" and "elevator". */
+bool block_set_scheduler (struct block *, const char *name);
+bool block_set_default_scheduler (const char *name);
+void block_share_queue (struct block *, struct block *with);
+
+/* Statistics.  Each device keeps latency histograms of the
+   requests it served, the queue depth seen by submitters and a
+   trace of recent requests.  block_print_stats() prints the
+   latency statistics only if block_iostat is true. */
+extern bool block_iostat;
 void block_print_stats (void);
+size_t block_format_stats (struct block *, char *buf, size_t size);
 
 /* Lower-level interface to block device drivers. */
 
@@ -67,6 +124,20 @@ struct block_operations
 {
   void (*read) (void *aux, block_sector_t, void *buffer);
   void (*write) (void *aux, block_sector_t, const void *buffer);
+
+  /* Optional: transfer CNT consecutive sectors in as few device
+     commands as possible.  If null, the block layer falls back to
+     one READ or WRITE per sector. */
+  void (*read_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                         void *buffer);
+  void (*write_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                          const void *buffer);
+
+  /* Optional, for devices stacked on another block device, such as
+     partitions: translates *SECTOR into a sector of the underlying
+     device and returns that device, so that requests are queued
+     and scheduled only once, on the physical device. */
+  struct block *(*remap) (void *aux, block_sector_t *sector);
 };
 
 struct block *block_register (const char *name, enum block_type,
@@ -4,11 +4,14 @@
 #include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 #include <ctype.h>
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +37,7 @@
 #define STA_BSY 0x80  /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
 #define STA_DRQ 0x08  /* Data Request. */
+#define STA_ERR 0x01  /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -43,12 +47,54 @@
 #define DEV_LBA 0x40 /* Linear based addressing. */
 #define DEV_DEV 0x10 /* Select device: 0=master, 1=slave. */
 
+/* Bus master IDE register offsets, relative to a channel's
+   bus master base (BAR4 of the controller, plus 8 for the
+   secondary channel). */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRDT address. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01 /* Start/stop bus master transfer. */
+#define BM_CMD_READ 0x08  /* Transfer direction: 1=device to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ACTIVE 0x01 /* Bus master IDE active. */
+#define BM_STA_ERROR 0x02  /* DMA transfer failed. */
+#define BM_STA_INTR 0x04   /* Device asserted its interrupt. */
+
+/* PCI configuration space access. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_CLASS_IDE 0x0101  /* Mass storage, IDE interface. */
+#define PCI_PROGIF_BUS_MASTER 0x80 /* Controller can bus master. */
+#define PCI_COMMAND_BUS_MASTER 0x04 /* Command register: enable DMA. */
+
+/* Physical Region Descriptor: one physically contiguous piece of
+   a DMA buffer.  A piece may not cross a 64 kB boundary. */
+struct prd
+{
+  uint32_t addr;  /* Physical address of the piece. */
+  uint16_t size;  /* Bytes in the piece, 0 meaning 64 kB. */
+  uint16_t flags; /* PRD_EOT on the last entry of the table. */
+};
+#define PRD_EOT 0x8000
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec    /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4      /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5     /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6  /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8           /* READ DMA. */
+#define CMD_WRITE_DMA 0xca          /* WRITE DMA. */
+
+/* Most sectors moved by one READ/WRITE command.  The sector count
+   register is 8 bits wide, with 0 meaning 256. */
+#define IDE_MAX_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +103,9 @@ struct ata_disk
   struct channel *channel; /* Channel that disk is attached to. */
   int dev_no;              /* Device 0 or 1 for master or slave. */
   bool is_ata;             /* Is device an ATA disk? */
+  int multiple;            /* Sectors per DRQ block in READ/WRITE MULTIPLE,
+                              or 1 if multiple mode is not enabled. */
+  bool dma;                /* Use bus master DMA for transfers? */
 };
 
 /* An ATA channel (aka controller).
@@ -66,6 +115,10 @@ struct channel
   char name[8];      /* Name, e.g. "ide0". */
   uint16_t reg_base; /* Base I/O port. */
   uint8_t irq;       /* Interrupt in use. */
+  uint16_t bm_base;  /* Bus master base I/O port, 0 if no DMA. */
+  struct prd *prdt;  /* Physical region descriptor table. */
+  struct block *block; /* First disk registered on this channel, whose
+                          request queue and worker serve the channel. */
 
   struct lock lock;         /* Must acquire to access the controller. */
   bool expecting_interrupt; /* True if an interrupt is expected, false if
@@ -81,17 +134,33 @@ static struct channel channels[CHANNEL_CNT];
 
 static void ide_read (void *d_, block_sector_t sec_no, void *buffer);
 static void ide_write (void *d_, block_sector_t sec_no, const void *buffer);
+static void ide_read_multiple (void *d_, block_sector_t sec_no,
+                               block_sector_t cnt, void *buffer);
+static void ide_write_multiple (void *d_, block_sector_t sec_no,
+                                block_sector_t cnt, const void *buffer);
 
-static struct block_operations ide_operations = { ide_read, ide_write };
+static struct block_operations ide_operations
+    = { ide_read, ide_write, ide_read_multiple, ide_write_multiple, NULL };
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int sectors);
+static uint16_t find_bus_master (void);
+
+static bool dma_transfer (struct ata_disk *, block_sector_t, int cnt,
+                          void *buffer, bool write);
+static void pio_read_sectors (struct ata_disk *, block_sector_t, int cnt,
+                              void *buffer);
+static void pio_write_sectors (struct ata_disk *, block_sector_t, int cnt,
+                               const void *buffer);
+
+static void select_sector (struct ata_disk *, block_sector_t, int cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, int cnt);
+static void output_sectors (struct channel *, const void *, int cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -105,6 +174,7 @@ void
 ide_init (void)
 {
   size_t chan_no;
+  uint16_t bm_base = find_bus_master ();
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -130,6 +200,19 @@ ide_init (void)
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
 
+      /* Set up bus master DMA, if the controller supports it.
+         A page never crosses a 64 kB boundary, as the PRDT must
+         not. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      c->block = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
+
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         {
@@ -139,6 +222,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 1;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -305,9 +390,28 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Enable READ/WRITE MULTIPLE with the largest DRQ block the
+     disk supports (IDENTIFY word 47, bits 7:0). */
+  set_multiple_mode (d, *(uint16_t *)&id[47 * 2] & 0xff);
+
+  /* Use DMA if the channel has a bus master and the disk
+     supports DMA (IDENTIFY word 49, bit 8). */
+  d->dma = c->bm_base != 0 && (*(uint16_t *)&id[49 * 2] & 0x100) != 0;
+  if (d->dma)
+    strlcat (extra_info, ", DMA", sizeof extra_info);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+
+  /* The two disks on a channel cannot transfer at the same time,
+     so they share one request queue and worker thread.  Each
+     channel still has its own, so both channels run in
+     parallel. */
+  if (c->block == NULL)
+    c->block = block;
+  else
+    block_share_queue (block, c->block);
   partition_scan (block);
 }
 
@@ -339,6 +443,90 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Sends SET MULTIPLE MODE to disk D so that READ/WRITE MULTIPLE
+   move SECTORS sectors per interrupt.  Leaves D in single-sector
+   mode if SECTORS is not above 1 or the disk rejects the
+   command. */
+static void
+set_multiple_mode (struct ata_disk *d, int sectors)
+{
+  struct channel *c = d->channel;
+
+  d->multiple = 1;
+  if (sectors <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_alt_status (c)) & STA_ERR))
+    d->multiple = sectors;
+}
+
+/* Reads the 32-bit PCI configuration register at offset REG of
+   function FUNC of device DEV on bus BUS. */
+static uint32_t
+pci_config_read (int bus, int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (dev << 11)
+                                | (func << 8) | (reg & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the 32-bit PCI configuration register at offset
+   REG of function FUNC of device DEV on bus BUS. */
+static void
+pci_config_write (int bus, int dev, int func, int reg, uint32_t data)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (dev << 11)
+                                | (func << 8) | (reg & 0xfc));
+  outl (PCI_CONFIG_DATA, data);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, such as the PIIX emulated by QEMU and Bochs.
+   Enables bus mastering on it and returns its bus master base
+   I/O port (BAR4), or 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_config_read (0, dev, func, 0x00);
+        uint32_t class;
+        uint32_t bar4;
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            /* No such function.  If function 0 is missing, the
+               whole device is. */
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        class = pci_config_read (0, dev, func, 0x08);
+        if ((class >> 16) != PCI_CLASS_IDE
+            || !(class & (PCI_PROGIF_BUS_MASTER << 8)))
+          continue;
+
+        bar4 = pci_config_read (0, dev, func, 0x20);
+        if (!(bar4 & 1))
+          continue; /* Not an I/O space BAR. */
+
+        pci_config_write (0, dev, func, 0x04,
+                          pci_config_read (0, dev, func, 0x04)
+                              | PCI_COMMAND_BUS_MASTER);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -346,16 +534,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -365,31 +544,215 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Issues one command per IDE_MAX_SECTORS sectors.  The disk
+   interrupts once per DRQ block, which is D->multiple sectors
+   long with READ MULTIPLE and one sector otherwise.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      int n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, n, buffer, false))
+        pio_read_sectors (d, sec_no, n, buffer);
+
+      sec_no += n;
+      cnt -= n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+    }
   lock_release (&c->lock);
 }
 
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      int n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, n, (void *)buffer, true))
+        pio_write_sectors (d, sec_no, n, buffer);
+
+      sec_no += n;
+      cnt -= n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+    }
+  lock_release (&c->lock);
+}
+
+/* Reads CNT sectors, at most IDE_MAX_SECTORS, starting at SEC_NO
+   from disk D into BUFFER with one programmed I/O command.  The
+   disk interrupts once per DRQ block, which is D->multiple
+   sectors long with READ MULTIPLE and one sector otherwise.
+   D's channel must be locked. */
+static void
+pio_read_sectors (struct ata_disk *d, block_sector_t sec_no, int cnt,
+                  void *buffer_)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  int done;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 1 ? CMD_READ_MULTIPLE
+                                        : CMD_READ_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += d->multiple)
+    {
+      int blk = cnt - done < d->multiple ? cnt - done : d->multiple;
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%" PRDSNu, d->name,
+               sec_no + done);
+      input_sectors (c, buffer + done * BLOCK_SECTOR_SIZE, blk);
+    }
+}
+
+/* Writes CNT sectors, at most IDE_MAX_SECTORS, starting at SEC_NO
+   to disk D from BUFFER with one programmed I/O command.
+   D's channel must be locked. */
+static void
+pio_write_sectors (struct ata_disk *d, block_sector_t sec_no, int cnt,
+                   const void *buffer_)
+{
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  int done;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 1 ? CMD_WRITE_MULTIPLE
+                                        : CMD_WRITE_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += d->multiple)
+    {
+      int blk = cnt - done < d->multiple ? cnt - done : d->multiple;
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%" PRDSNu, d->name,
+               sec_no + done);
+      output_sectors (c, buffer + done * BLOCK_SECTOR_SIZE, blk);
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Fills D's channel PRDT to describe the SIZE bytes at kernel
+   virtual address BUFFER.  Returns false if BUFFER cannot be
+   used for DMA, in which case the caller should fall back to
+   PIO. */
+static bool
+build_prdt (struct channel *c, uint8_t *buffer, size_t size)
+{
+  size_t max_prds = PGSIZE / sizeof *c->prdt;
+  size_t i = 0;
+
+  /* Bus masters transfer whole words from word-aligned physical
+     addresses.  Kernel virtual memory is mapped linearly onto
+     physical memory, so only the 64 kB boundaries split it. */
+  if (!is_kernel_vaddr (buffer) || ((uintptr_t)buffer & 1) != 0)
+    return false;
+
+  while (size > 0)
+    {
+      uint32_t addr = vtop (buffer);
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+      if (i == max_prds)
+        return false;
+
+      c->prdt[i].addr = addr;
+      c->prdt[i].size = chunk & 0xffff;
+      c->prdt[i].flags = 0;
+      i++;
+
+      buffer += chunk;
+      size -= chunk;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors, at most IDE_MAX_SECTORS, starting at
+   SEC_NO between disk D and BUFFER using bus master DMA.  WRITE
+   selects the direction.  The calling thread sleeps until the
+   completion interrupt, so the CPU is free for other threads
+   while the controller moves the data.  Returns false without
+   transferring if BUFFER is unsuitable for DMA.  If the
+   controller reports an error, disables DMA for D and returns
+   false so that the caller retries with PIO.
+   D's channel must be locked. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, int cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t status;
+
+  if (!build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  /* Program the bus master: PRDT, direction, clear the sticky
+     error and interrupt bits by writing 1s. */
+  outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERROR
+                               | BM_STA_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+  outb (reg_bm_status (c), status | BM_STA_ERROR | BM_STA_INTR);
+  wait_while_busy (d);
+
+  if ((status & BM_STA_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+    {
+      printf ("%s: DMA transfer failed, falling back to PIO\n", d->name);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, int cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= IDE_MAX_SECTORS);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == IDE_MAX_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -418,12 +781,21 @@ input_sector (struct channel *c, void *sector)
   insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors of one DRQ block from channel C in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+input_sectors (struct channel *c, void *sectors, int cnt)
+{
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
+}
+
+/* Writes CNT sectors of one DRQ block from SECTORS to channel C
+   in PIO mode. */
 static void
-output_sector (struct channel *c, const void *sector)
+output_sectors (struct channel *c, const void *sectors, int cnt)
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
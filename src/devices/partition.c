@@ -16,9 +16,15 @@ struct partition
 static void partition_read (void *p_, block_sector_t sector, void *buffer);
 static void partition_write (void *p_, block_sector_t sector,
                              const void *buffer);
+static void partition_read_multiple (void *p_, block_sector_t sector,
+                                     block_sector_t cnt, void *buffer);
+static void partition_write_multiple (void *p_, block_sector_t sector,
+                                      block_sector_t cnt, const void *buffer);
+static struct block *partition_remap (void *p_, block_sector_t *sector);
 
 static struct block_operations partition_operations
-    = { partition_read, partition_write };
+    = { partition_read, partition_write, partition_read_multiple,
+        partition_write_multiple, partition_remap };
 
 static void read_partition_table (struct block *, block_sector_t sector,
                                   block_sector_t primary_extended_sector,
@@ -417,3 +423,35 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   struct partition *p = p_;
   block_write (p->block, p->start + sector, buffer);
 }
+
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector, block_sector_t cnt,
+                         void *buffer)
+{
+  struct partition *p = p_;
+  block_read_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block has acknowledged receiving the data. */
+static void
+partition_write_multiple (void *p_, block_sector_t sector, block_sector_t cnt,
+                          const void *buffer)
+{
+  struct partition *p = p_;
+  block_write_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/* Translates *SECTOR of partition P into a sector of the
+   underlying block device, which is returned. */
+static struct block *
+partition_remap (void *p_, block_sector_t *sector)
+{
+  struct partition *p = p_;
+  *sector += p->start;
+  return p->block;
+}
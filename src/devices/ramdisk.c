@@ -0,0 +1,154 @@
+#include "devices/ramdisk.h"
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A RAM disk: a block device whose sectors live in kernel pages.
+   It has no seek or transfer latency, so it is useful to measure
+   file system and VM overheads on their own, and as fast scratch
+   or swap space.  Its contents are lost at power off. */
+
+/* Most RAM disks, named "ram0", "ram1", .... */
+#define RAMDISK_CNT 4
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+struct ramdisk
+{
+  char name[8];    /* Name, e.g. "ram0". */
+  size_t page_cnt; /* Number of pages. */
+  uint8_t **pages; /* PAGE_CNT kernel pages holding the sectors. */
+};
+
+static struct ramdisk ramdisks[RAMDISK_CNT];
+static size_t ramdisk_cnt;
+
+static void ramdisk_read (void *rd_, block_sector_t, void *buffer);
+static void ramdisk_write (void *rd_, block_sector_t, const void *buffer);
+static void ramdisk_read_multiple (void *rd_, block_sector_t,
+                                   block_sector_t cnt, void *buffer);
+static void ramdisk_write_multiple (void *rd_, block_sector_t,
+                                    block_sector_t cnt, const void *buffer);
+
+static struct block_operations ramdisk_operations
+    = { ramdisk_read, ramdisk_write, ramdisk_read_multiple,
+        ramdisk_write_multiple, NULL };
+
+/* Requests a RAM disk of KB kilobytes, rounded up to whole pages,
+   to be created by ramdisk_init().  May be called before the
+   memory allocators are initialized, e.g. while parsing the
+   kernel command line.  Returns false if KB is zero or too many
+   RAM disks were requested. */
+bool
+ramdisk_configure (size_t kb)
+{
+  struct ramdisk *rd;
+
+  if (kb == 0 || ramdisk_cnt >= RAMDISK_CNT)
+    return false;
+
+  rd = &ramdisks[ramdisk_cnt];
+  snprintf (rd->name, sizeof rd->name, "ram%zu", ramdisk_cnt);
+  rd->page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  rd->pages = NULL;
+  ramdisk_cnt++;
+  return true;
+}
+
+/* Allocates the memory of the configured RAM disks and registers
+   them as raw block devices, so that they can be cast in any
+   role with -filesys, -scratch or -swap. */
+void
+ramdisk_init (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < ramdisk_cnt; i++)
+    {
+      struct ramdisk *rd = &ramdisks[i];
+
+      rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+      if (rd->pages == NULL)
+        PANIC ("%s: out of memory", rd->name);
+      for (j = 0; j < rd->page_cnt; j++)
+        {
+          rd->pages[j] = palloc_get_page (PAL_ZERO);
+          if (rd->pages[j] == NULL)
+            PANIC ("%s: out of memory after %zu of %zu pages", rd->name, j,
+                   rd->page_cnt);
+        }
+
+      block_register (rd->name, BLOCK_RAW, "RAM disk",
+                      rd->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations,
+                      rd);
+    }
+}
+
+/* Returns the address of SECTOR in RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return rd->pages[sector / SECTORS_PER_PAGE]
+         + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads sector SECTOR from RAM disk RD_ into BUFFER. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (rd_, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to RAM disk RD_ from BUFFER. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (rd_, sector, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from RAM disk RD_ into
+   BUFFER, one page-sized run at a time. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sector, block_sector_t cnt,
+                       void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t run = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (run > cnt)
+        run = cnt;
+      memcpy (buffer, sector_addr (rd, sector), run * BLOCK_SECTOR_SIZE);
+      buffer += run * BLOCK_SECTOR_SIZE;
+      sector += run;
+      cnt -= run;
+    }
+}
+
+/* Writes CNT sectors starting at SECTOR to RAM disk RD_ from
+   BUFFER, one page-sized run at a time. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sector, block_sector_t cnt,
+                        const void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t run = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (run > cnt)
+        run = cnt;
+      memcpy (sector_addr (rd, sector), buffer, run * BLOCK_SECTOR_SIZE);
+      buffer += run * BLOCK_SECTOR_SIZE;
+      sector += run;
+      cnt -= run;
+    }
+}
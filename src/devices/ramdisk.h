@@ -0,0 +1,10 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool ramdisk_configure (size_t kb);
+void ramdisk_init (void);
+
+#endif /* devices/ramdisk.h */
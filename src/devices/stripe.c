@@ -0,0 +1,202 @@
+#include "devices/stripe.h"
+#include "devices/block.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A striped (RAID-0) block device.  Its sectors are dealt out in
+   chunks of CHUNK sectors to its members in turn: chunk 0 goes to
+   member 0, chunk 1 to member 1, and so on, wrapping around.  A
+   large sequential transfer thus keeps every member busy, and
+   members on different IDE channels transfer in parallel.  There
+   is no redundancy: losing one member loses the whole device. */
+
+/* Most striped devices, named "md0", "md1", .... */
+#define STRIPE_CNT 2
+
+/* Most members of one striped device. */
+#define STRIPE_MEMBERS_MAX 4
+
+/* Default chunk size, in sectors. */
+#define STRIPE_CHUNK_DEFAULT 16
+
+/* Most member requests one transfer keeps in flight. */
+#define STRIPE_BATCH 8
+
+struct stripe
+{
+  char name[8];                                 /* Name, e.g. "md0". */
+  const char *member_names[STRIPE_MEMBERS_MAX]; /* From the command line. */
+  struct block *members[STRIPE_MEMBERS_MAX];    /* Member devices. */
+  size_t member_cnt;                            /* Number of members. */
+  block_sector_t chunk;                         /* Chunk size in sectors. */
+};
+
+static struct stripe stripes[STRIPE_CNT];
+static size_t stripe_cnt;
+
+static void stripe_read (void *s_, block_sector_t, void *buffer);
+static void stripe_write (void *s_, block_sector_t, const void *buffer);
+static void stripe_read_multiple (void *s_, block_sector_t,
+                                  block_sector_t cnt, void *buffer);
+static void stripe_write_multiple (void *s_, block_sector_t,
+                                   block_sector_t cnt, const void *buffer);
+
+static struct block_operations stripe_operations
+    = { stripe_read, stripe_write, stripe_read_multiple,
+        stripe_write_multiple, NULL };
+
+/* Requests a striped device to be created by stripe_init() from
+   SPEC, which has the form "DEV,DEV[,DEV...][:CHUNK]": the names
+   of two or more member block devices, optionally followed by
+   the chunk size in sectors.  SPEC is modified and must stay
+   valid until stripe_init() is called.  Returns false if SPEC is
+   malformed or too many striped devices were requested. */
+bool
+stripe_configure (char *spec)
+{
+  struct stripe *s;
+  char *chunk, *name, *save_ptr;
+
+  if (spec == NULL || stripe_cnt >= STRIPE_CNT)
+    return false;
+
+  s = &stripes[stripe_cnt];
+  s->member_cnt = 0;
+  s->chunk = STRIPE_CHUNK_DEFAULT;
+
+  chunk = strchr (spec, ':');
+  if (chunk != NULL)
+    {
+      *chunk++ = '\0';
+      if (atoi (chunk) <= 0)
+        return false;
+      s->chunk = atoi (chunk);
+    }
+
+  for (name = strtok_r (spec, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      if (s->member_cnt >= STRIPE_MEMBERS_MAX)
+        return false;
+      s->member_names[s->member_cnt++] = name;
+    }
+  if (s->member_cnt < 2)
+    return false;
+
+  snprintf (s->name, sizeof s->name, "md%zu", stripe_cnt);
+  stripe_cnt++;
+  return true;
+}
+
+/* Looks up the members of the configured striped devices and
+   registers the devices as raw block devices, so that they can
+   be cast in any role with -filesys, -scratch or -swap.  Must be
+   called after the member devices have been registered. */
+void
+stripe_init (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < stripe_cnt; i++)
+    {
+      struct stripe *s = &stripes[i];
+      block_sector_t member_size = (block_sector_t)-1;
+      char extra_info[64];
+
+      for (j = 0; j < s->member_cnt; j++)
+        {
+          struct block *m = block_get_by_name (s->member_names[j]);
+          if (m == NULL)
+            PANIC ("%s: no such block device \"%s\"", s->name,
+                   s->member_names[j]);
+          if (block_type (m) == BLOCK_KERNEL)
+            PANIC ("%s: cannot stripe over kernel device %s", s->name,
+                   block_name (m));
+          s->members[j] = m;
+          if (block_size (m) < member_size)
+            member_size = block_size (m);
+        }
+
+      /* Only whole chunks of the smallest member are used. */
+      member_size -= member_size % s->chunk;
+      if (member_size == 0)
+        PANIC ("%s: members smaller than one %" PRDSNu "-sector chunk",
+               s->name, s->chunk);
+
+      snprintf (extra_info, sizeof extra_info,
+                "RAID-0 over %zu devices, %" PRDSNu "-sector chunks",
+                s->member_cnt, s->chunk);
+      block_register (s->name, BLOCK_RAW, extra_info,
+                      member_size * s->member_cnt, &stripe_operations, s);
+    }
+}
+
+/* Transfers CNT sectors starting at SECTOR between striped device
+   S_ and BUFFER.  The range is split at chunk boundaries and each
+   piece is submitted to its member without waiting, so that
+   members on different channels work at the same time. */
+static void
+stripe_transfer (void *s_, bool write, block_sector_t sector,
+                 block_sector_t cnt, uint8_t *buffer)
+{
+  struct stripe *s = s_;
+  struct block_request reqs[STRIPE_BATCH];
+  size_t n, i;
+
+  while (cnt > 0)
+    {
+      for (n = 0; n < STRIPE_BATCH && cnt > 0; n++)
+        {
+          block_sector_t chunk = sector / s->chunk;
+          block_sector_t ofs = sector % s->chunk;
+          block_sector_t run = s->chunk - ofs;
+          struct block *m = s->members[chunk % s->member_cnt];
+
+          if (run > cnt)
+            run = cnt;
+          block_request_init (&reqs[n], write,
+                              chunk / s->member_cnt * s->chunk + ofs, run,
+                              buffer, NULL, NULL);
+          block_submit (m, &reqs[n]);
+          buffer += run * BLOCK_SECTOR_SIZE;
+          sector += run;
+          cnt -= run;
+        }
+      for (i = 0; i < n; i++)
+        block_wait (&reqs[i]);
+    }
+}
+
+/* Reads sector SECTOR from striped device S_ into BUFFER. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s_, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to striped device S_ from BUFFER. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s_, true, sector, 1, (void *)buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from striped device S_
+   into BUFFER. */
+static void
+stripe_read_multiple (void *s_, block_sector_t sector, block_sector_t cnt,
+                      void *buffer)
+{
+  stripe_transfer (s_, false, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to striped device S_ from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s_, block_sector_t sector, block_sector_t cnt,
+                       const void *buffer)
+{
+  stripe_transfer (s_, true, sector, cnt, (void *)buffer);
+}
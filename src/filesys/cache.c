@@ -2,6 +2,7 @@
 #include "devices/block.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -14,6 +15,10 @@ struct lock cache_clock_list_lock;
 
 struct hash cache_table;
 
+// read-ahead completion, see `cache_wait_loaded`
+static struct lock cache_load_lock;
+static struct condition cache_loaded;
+
 uint8_t cache[CACHE_SIZE][BLOCK_SECTOR_SIZE];
 struct cache_entry cache_entries[CACHE_SIZE];
 int cache_count;
@@ -72,7 +77,13 @@ clock_find_block_to_evict (void)
     {
       evict_entry = list_entry (cache_clock_list_iterator, struct cache_entry,
                                 list_elem);
-      if (lock_try_acquire (&evict_entry->lock))
+      if (evict_entry->pinned || evict_entry->loading)
+        {
+          // never write back a sector of an uncommitted transaction,
+          // nor reuse a buffer the disk is still filling
+          cache_clock_list_next ();
+        }
+      else if (lock_try_acquire (&evict_entry->lock))
         {
           if (evict_entry->accessed)
             {
@@ -122,6 +133,8 @@ cache_table_init ()
       e->dirty = false;
       e->valid = false;
       e->accessed = false;
+      e->pinned = false;
+      e->loading = false;
       e->sector = 0;
       e->data = &cache[i][0];
       lock_init (&e->lock);
@@ -129,6 +142,8 @@ cache_table_init ()
   hash_init (&cache_table, cache_table_hash, cache_table_less, NULL);
   lock_init (&cache_clock_list_lock);
   list_init (&cache_clock_list);
+  lock_init (&cache_load_lock);
+  cond_init (&cache_loaded);
 }
 
 struct cache_entry *
@@ -141,8 +156,12 @@ cache_table_find (block_sector_t sector)
                       : NULL;
 }
 
+/**
+ * @brief Get a free cache entry, evicting (and writing back) one if the
+ * cache is full
+ */
 static struct cache_entry *
-cache_get_block (block_sector_t sector)
+cache_alloc_block (void)
 {
   struct cache_entry *entry;
   // if cache is full, evict a block
@@ -156,16 +175,105 @@ cache_get_block (block_sector_t sector)
     }
   else
     entry = &cache_entries[cache_count++];
+  return entry;
+}
 
-  block_read (fs_device, sector, entry->data);
+/**
+ * @brief Make `entry`, whose data already holds the contents of `sector`,
+ * the cached copy of `sector`
+ */
+static void
+cache_bind_block (struct cache_entry *entry, block_sector_t sector)
+{
   entry->valid = true;
   entry->dirty = false;
+  entry->pinned = false;
   entry->sector = sector;
   hash_insert (&cache_table, &entry->hash_elem);
   cache_clock_list_push_back (&entry->list_elem);
+}
+
+static struct cache_entry *
+cache_get_block (block_sector_t sector)
+{
+  struct cache_entry *entry = cache_alloc_block ();
+  block_read (fs_device, sector, entry->data);
+  cache_bind_block (entry, sector);
   return entry;
 }
 
+/**
+ * @brief Completion callback of a read-ahead request: mark the entry
+ * loaded and wake up threads waiting for it
+ * @note Runs in the block device's worker thread
+ */
+static void
+cache_read_ahead_done (struct block_request *req UNUSED, void *entry_)
+{
+  struct cache_entry *entry = entry_;
+  lock_acquire (&cache_load_lock);
+  entry->loading = false;
+  cond_broadcast (&cache_loaded, &cache_load_lock);
+  lock_release (&cache_load_lock);
+}
+
+/**
+ * @brief Wait until `entry` is no longer being filled by read-ahead
+ */
+static void
+cache_wait_loaded (struct cache_entry *entry)
+{
+  if (!entry->loading)
+    return;
+  lock_acquire (&cache_load_lock);
+  while (entry->loading)
+    cond_wait (&cache_loaded, &cache_load_lock);
+  lock_release (&cache_load_lock);
+}
+
+/**
+ * @brief Start bringing `sector` into the cache, without waiting for the
+ * disk
+ * @note An uncached sector gets an entry marked loading and its own
+ * asynchronous request; the block layer merges the requests for adjacent
+ * sectors into a single transfer
+ */
+void
+cache_prefetch (block_sector_t sector)
+{
+  struct cache_entry *entry = cache_table_find (sector);
+  if (entry != NULL)
+    {
+      lock_acquire (&entry->lock);
+      entry->accessed = true;
+      lock_release (&entry->lock);
+      return;
+    }
+
+  entry = cache_alloc_block ();
+  entry->accessed = true;
+  entry->loading = true;
+  cache_bind_block (entry, sector);
+  block_request_init (&entry->read_ahead, false, sector, 1, entry->data,
+                      cache_read_ahead_done, entry);
+  block_submit (fs_device, &entry->read_ahead);
+}
+
+/**
+ * @brief Start bringing the READ_AHEAD_COUNT sectors after `sector` into
+ * the cache, without waiting for the disk
+ */
+static void
+cache_read_ahead (block_sector_t sector)
+{
+  block_sector_t end = MIN (sector + 1 + READ_AHEAD_COUNT,
+                            block_size (fs_device));
+
+  for (block_sector_t next_sector = sector + 1; next_sector < end;
+       next_sector++)
+    cache_prefetch (next_sector);
+}
+
 void
 cache_read (block_sector_t sector, void *buffer)
 {
@@ -174,30 +282,18 @@ cache_read (block_sector_t sector, void *buffer)
   if (entry == NULL)
     // evict a cache block
     entry = cache_get_block (sector);
+  cache_wait_loaded (entry);
 
   lock_acquire (&entry->lock);
   entry->accessed = true;
   memcpy (buffer, entry->data, BLOCK_SECTOR_SIZE);
   lock_release (&entry->lock);
 
-  for (int i = 1; i <= READ_AHEAD_COUNT; i++)
-    {
-      block_sector_t next_sector = sector + i;
-      if (next_sector >= block_size (fs_device))
-        break;
-
-      struct cache_entry *entry = cache_table_find (next_sector);
-      if (entry == NULL)
-        entry = cache_get_block (next_sector);
-
-      lock_acquire (&entry->lock);
-      entry->accessed = true;
-      lock_release (&entry->lock);
-    }
+  cache_read_ahead (sector);
 }
 
-void
-cache_write (block_sector_t sector, const void *buffer)
+static void
+cache_write_entry (block_sector_t sector, const void *buffer, bool logged)
 {
   struct cache_entry *entry = cache_table_find (sector);
   // if entry is not in cache
@@ -206,29 +302,142 @@ cache_write (block_sector_t sector, const void *buffer)
       // evict a cache block
       entry = cache_get_block (sector);
     }
+  cache_wait_loaded (entry);
+
+  // recorded first: the group cannot commit while this transaction is
+  // open
+  if (logged)
+    journal_record (sector);
+
   lock_acquire (&entry->lock);
   entry->accessed = true;
   entry->dirty = true;
+  // an unlogged write to a pinned sector follows `journal_revoke`
+  entry->pinned = logged;
   memcpy (entry->data, buffer, BLOCK_SECTOR_SIZE);
   lock_release (&entry->lock);
 }
 
+/**
+ * @brief Write `buffer` to `sector` through the cache
+ * @note Inside a journal transaction the write is logged and the entry
+ * stays pinned until the transaction's group is committed
+ */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_entry (sector, buffer, journal_in_transaction ());
+}
+
+/**
+ * @brief Write `buffer` to `sector` through the cache, bypassing the
+ * journal even inside a transaction
+ * @note Used for file data, which is not journaled
+ */
+void
+cache_write_unlogged (block_sector_t sector, const void *buffer)
+{
+  cache_write_entry (sector, buffer, false);
+}
+
+/**
+ * @brief Copy the cached copy of `sector` into `buffer` for the journal
+ * @note `sector` must be pinned by the journal
+ */
+void
+cache_log (block_sector_t sector, void *buffer)
+{
+  struct cache_entry *entry = cache_table_find (sector);
+  ASSERT (entry != NULL && entry->pinned);
+  lock_acquire (&entry->lock);
+  memcpy (buffer, entry->data, BLOCK_SECTOR_SIZE);
+  lock_release (&entry->lock);
+}
+
+/**
+ * @brief Unpin `sector` once its group is committed, leaving it dirty so
+ * that ordinary write-back installs it
+ * @note `sector` must be pinned by the journal
+ */
+void
+cache_commit (block_sector_t sector)
+{
+  struct cache_entry *entry = cache_table_find (sector);
+  ASSERT (entry != NULL && entry->pinned);
+  lock_acquire (&entry->lock);
+  entry->pinned = false;
+  lock_release (&entry->lock);
+}
+
+/**
+ * @brief Write the cached copy of `sector` to its home location, if it
+ * has not been written back yet
+ * @note `sector` must be committed
+ */
+void
+cache_install (block_sector_t sector)
+{
+  struct cache_entry *entry = cache_table_find (sector);
+  if (entry == NULL)
+    return;
+  lock_acquire (&entry->lock);
+  ASSERT (!entry->pinned);
+  if (entry->dirty)
+    {
+      block_write (fs_device, sector, entry->data);
+      entry->dirty = false;
+    }
+  lock_release (&entry->lock);
+}
+
+/**
+ * @brief Write every dirty block back and invalidate the cache
+ * @note Dirty blocks with consecutive sectors are written back together,
+ * up to CACHE_FLUSH_RUN sectors per transfer
+ */
 void
 cache_flush ()
 {
+  uint8_t *run = malloc (CACHE_FLUSH_RUN * BLOCK_SECTOR_SIZE);
+
   for (struct list_elem *e = list_begin (&cache_clock_list);
        e != list_end (&cache_clock_list); e = list_next (e))
     {
       struct cache_entry *entry
           = list_entry (e, struct cache_entry, list_elem);
-      lock_acquire (&entry->lock);
-      if (entry->dirty)
+      if (!entry->dirty)
+        continue;
+
+      block_sector_t cnt = 0;
+      struct cache_entry *next = entry;
+      do
         {
-          block_write (fs_device, entry->sector, entry->data);
+          lock_acquire (&next->lock);
+          if (run != NULL)
+            memcpy (run + cnt * BLOCK_SECTOR_SIZE, next->data,
+                    BLOCK_SECTOR_SIZE);
+          else
+            block_write (fs_device, next->sector, next->data);
+          next->dirty = false;
+          lock_release (&next->lock);
+          cnt++;
         }
-      lock_release (&entry->lock);
+      while (run != NULL && cnt < CACHE_FLUSH_RUN
+             && (next = cache_table_find (entry->sector + cnt)) != NULL
+             && next->dirty);
+
+      if (run != NULL)
+        block_write_multiple (fs_device, entry->sector, cnt, run);
+    }
+  free (run);
+
+  for (struct list_elem *e = list_begin (&cache_clock_list);
+       e != list_end (&cache_clock_list); e = list_next (e))
+    {
+      struct cache_entry *entry
+          = list_entry (e, struct cache_entry, list_elem);
       entry->valid = false;
       entry->dirty = false;
       entry->sector = 0;
     }
-}
\ No newline at end of file
+}
@@ -10,22 +10,32 @@
 
 #define CACHE_SIZE 64 /* no greater than 64 sectors */
 #define READ_AHEAD_COUNT 5
+#define CACHE_FLUSH_RUN 16 /* most sectors written back by one transfer */
 
 struct cache_entry
 {
   bool dirty : 1;
   bool valid : 1;
   bool accessed : 1;
+  bool pinned : 1; /* logged by an uncommitted journal transaction */
+  bool loading;    /* being filled by an asynchronous read-ahead, not a
+                      bit-field since the block worker clears it */
   block_sector_t sector;
   uint8_t *data;
   struct lock lock;
+  struct block_request read_ahead; // in-flight read-ahead of this block
   struct list_elem list_elem; // for clock algorithm
   struct hash_elem hash_elem; // for hash table
 };
 
 void cache_init (void);
 void cache_read (block_sector_t sector, void *buffer);
+void cache_prefetch (block_sector_t sector);
 void cache_write (block_sector_t sector, const void *buffer);
+void cache_write_unlogged (block_sector_t sector, const void *buffer);
+void cache_log (block_sector_t sector, void *buffer);
+void cache_commit (block_sector_t sector);
+void cache_install (block_sector_t sector);
 void cache_flush (void);
 
 void cache_table_init (void);
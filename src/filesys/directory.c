@@ -12,6 +12,12 @@
 
 #define DIR_MAGIC 0x726964
 
+/* Sectors one dir_add may log: the two sectors an entry may straddle,
+   the directory's inode and the pointer blocks of a one-sector growth,
+   which allocates up to DIR_ADD_ALLOC sectors. */
+#define DIR_ADD_LOG 5
+#define DIR_ADD_ALLOC 3
+
 bool
 is_dir (struct dir *dir)
 {
@@ -46,6 +52,18 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 #endif
 }
 
+/**
+ * @brief Log slots a journal transaction reserves for `subdir_create`:
+ * the new inode, the first sector of the new directory, and `dir_add`
+ * in the parent, whose nested `dir_add` of ".." writes the same two
+ * sectors of the new directory
+ */
+size_t
+subdir_create_log_size (void)
+{
+  return 2 + DIR_ADD_LOG + free_map_log_size (2 + DIR_ADD_ALLOC);
+}
+
 /**
  * @brief create a subdir with name NAME in DIR
  * @return true if successful, false otherwise
@@ -64,6 +82,16 @@ subdir_create (struct dir *parent, const char *name)
   return success;
 }
 
+/**
+ * @brief Log slots a journal transaction reserves for `subfile_create`
+ * of an empty file: the new inode and `dir_add` in the parent
+ */
+size_t
+subfile_create_log_size (void)
+{
+  return 1 + DIR_ADD_LOG + free_map_log_size (1 + DIR_ADD_ALLOC);
+}
+
 bool
 subfile_create (struct dir *parent, const char *name, off_t initial_size)
 {
@@ -343,6 +371,18 @@ done:
   return success;
 }
 
+/**
+ * @brief Log slots a journal transaction reserves for `subdir_remove` or
+ * `subfile_remove`: the two sectors of the parent an entry may straddle,
+ * the first sector of a removed directory, and the removed inode, which
+ * is closed within the transaction unless it is still open elsewhere
+ */
+size_t
+dir_remove_log_size (void)
+{
+  return 3 + inode_close_log_size ();
+}
+
 static bool
 dir_is_empty (struct dir *dir)
 {
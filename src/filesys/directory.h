@@ -49,11 +49,14 @@ bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
 
 /* subdir operations */
+size_t subdir_create_log_size (void);
 bool subdir_create (struct dir *parent, const char *name);
 struct dir *subdir_lookup (struct dir *parent, const char *name);
 bool subdir_remove (struct dir *parent, const char *name);
+size_t dir_remove_log_size (void);
 
 /* subfile operations */
+size_t subfile_create_log_size (void);
 bool subfile_create (struct dir *parent, const char *name, off_t initial_size);
 struct file *subfile_lookup (struct dir *parent, const char *name);
 bool subfile_remove (struct dir *parent, const char *name);
@@ -104,6 +104,15 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Starts reading SIZE bytes of FILE at offset FILE_OFS into the
+   buffer cache, without waiting for them.  A later read of the
+   range then finds it cached or in flight. */
+void
+file_prefetch (struct file *file, off_t size, off_t file_ofs)
+{
+  inode_prefetch (file->inode, size, file_ofs);
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
@@ -4,6 +4,7 @@
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 #include <debug.h>
@@ -21,6 +22,12 @@ acquire_filesys (void)
   lock_acquire (&filesys_lock);
 }
 
+bool
+try_acquire_filesys (void)
+{
+  return lock_try_acquire (&filesys_lock);
+}
+
 void
 release_filesys (void)
 {
@@ -144,18 +151,21 @@ filesys_init (bool format)
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
+#ifdef USERPROG
+  lock_init (&filesys_lock);
+#endif
 
   cache_table_init ();
+  journal_init ();
   inode_init ();
   free_map_init ();
 
   if (format)
     do_format ();
+  else
+    journal_recover ();
 
   free_map_open ();
-#ifdef USERPROG
-  lock_init (&filesys_lock);
-#endif
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -164,6 +174,7 @@ void
 filesys_done (void)
 {
   acquire_filesys ();
+  journal_flush ();
   cache_flush ();
   free_map_close ();
   release_filesys ();
@@ -190,7 +201,25 @@ filesys_create (const char *name, off_t initial_size)
         }
       else
         {
-          bool success = subfile_create (dir, file_name, initial_size);
+          /* Create the file empty, then allocate its blocks in
+             bounded transactions, since a large initial size
+             would not fit in the log. */
+          journal_begin (subfile_create_log_size ());
+          bool success = subfile_create (dir, file_name, 0);
+          journal_end ();
+          struct inode *inode;
+          if (success && initial_size > 0
+              && dir_lookup (dir, file_name, &inode))
+            {
+              success = inode_grow (inode, initial_size);
+              inode_close (inode);
+              if (!success)
+                {
+                  journal_begin (dir_remove_log_size ());
+                  subfile_remove (dir, file_name);
+                  journal_end ();
+                }
+            }
           dir_close (dir);
           return success;
         }
@@ -262,8 +291,10 @@ filesys_remove (const char *name)
   bool is_file;
   if (!filesys_parsing_path (name, file_name, &dir, &is_file))
     return false;
+  journal_begin (dir_remove_log_size ());
   bool success
       = subdir_remove (dir, file_name) || subfile_remove (dir, file_name);
+  journal_end ();
   return success;
 
 #else
@@ -347,7 +378,11 @@ filesys_mkdir (const char *name)
   bool is_file;
   bool success = false;
   if (filesys_parsing_path (name, dir_name, &dir, &is_file))
-    success = subdir_create (dir, dir_name);
+    {
+      journal_begin (subdir_create_log_size ());
+      success = subdir_create (dir, dir_name);
+      journal_end ();
+    }
 
   dir_close (dir);
   return success;
@@ -360,6 +395,7 @@ static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_format ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
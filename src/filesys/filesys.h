@@ -25,6 +25,7 @@ bool filesys_readdir (int fd, char *name);
 int filesys_inumber (int fd);
 
 void acquire_filesys (void);
+bool try_acquire_filesys (void);
 void release_filesys (void);
 bool has_acquired_filesys (void);
 
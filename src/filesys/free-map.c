@@ -2,8 +2,10 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 
 static struct file *free_map_file; /* Free map file. */
 static struct bitmap *free_map;    /* Free map, one bit per sector. */
@@ -17,19 +19,21 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SIZE + 1, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
-   written. */
+   written.  Only the part of the free map file that changed is
+   written, so a transaction logs few sectors of it. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
   block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
   if (sector != BITMAP_ERROR && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
     {
       bitmap_set_multiple (free_map, sector, cnt, false);
       sector = BITMAP_ERROR;
@@ -45,7 +49,18 @@ free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+}
+
+/* Returns the most sectors of the free map file that allocating
+   or releasing CNT sectors, one at a time, may write.  A journal
+   transaction reserves that many log slots for the free map. */
+size_t
+free_map_log_size (size_t cnt)
+{
+  size_t file_sectors
+      = DIV_ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+  return cnt < file_sectors ? cnt : file_sectors;
 }
 
 /* Opens the free map file and reads it from disk. */
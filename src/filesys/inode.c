@@ -2,6 +2,7 @@
 #include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <debug.h>
@@ -78,18 +79,55 @@ inode_init (void)
   list_init (&open_inodes);
 }
 
+/* Bytes an inode may grow by within a single journal transaction.
+   One step allocates POINTERS_PER_BLOCK data sectors and writes the
+   inode and at most three pointer blocks: two adjacent indirect
+   blocks, or an indirect block and the doubly indirect block above
+   it, plus the last indirect block when crossing into that region. */
+#define INODE_GROW_STEP (POINTERS_PER_BLOCK * BLOCK_SECTOR_SIZE)
+#define INODE_GROW_LOG 4 /* Sectors one step logs, besides the free map. */
+
+/**
+ * @brief Log slots a journal transaction reserves for one step of
+ * `inode_grow`
+ */
+static size_t
+inode_grow_log_size (void)
+{
+  return INODE_GROW_LOG + free_map_log_size (POINTERS_PER_BLOCK + 3);
+}
+
+/**
+ * @brief Log slots a journal transaction reserves for closing a removed
+ * inode: its own sector and the free map, for releasing its blocks
+ */
+size_t
+inode_close_log_size (void)
+{
+  return 1 + free_map_log_size (block_size (fs_device));
+}
+
 /**
  * @brief alloc a zeroed sector
  * @param sectorp the pointer to the sector which store the return value
+ * @param meta whether the sector holds metadata (an indirect block), which
+ * is journaled, rather than file data, which is not
  * @return true if successfully allocated else false
  */
 static bool
-block_calloc (block_sector_t *sectorp)
+block_calloc (block_sector_t *sectorp, bool meta)
 {
   static uint8_t zeros[BLOCK_SECTOR_SIZE];
   if (!free_map_allocate (1, sectorp))
     return false;
-  cache_write (*sectorp, zeros);
+  if (meta)
+    cache_write (*sectorp, zeros);
+  else
+    {
+      // the sector may have held logged metadata before it was freed
+      journal_revoke (*sectorp);
+      cache_write_unlogged (*sectorp, zeros);
+    }
   return true;
 }
 
@@ -98,16 +136,23 @@ block_calloc (block_sector_t *sectorp)
  * call `block_calloc` for unallocated (non-zero) slots
  * @param sectorp the array of sectors
  * @param n the target size
+ * @param meta whether the slots point to indirect blocks
+ * @param grown set to true if any slot was allocated, may be NULL
  * @return true if successfully allocated else false
  */
 static bool
-block_arr_resize (block_sector_t direct_sectorp[], int n)
+block_arr_resize (block_sector_t direct_sectorp[], int n, bool meta,
+                  bool *grown)
 {
   int i = 0;
   for (; i < n; i++)
     if (direct_sectorp[i] == 0)
-      if (!block_calloc (&direct_sectorp[i]))
-        return false;
+      {
+        if (!block_calloc (&direct_sectorp[i], meta))
+          return false;
+        if (grown != NULL)
+          *grown = true;
+      }
   return i == n;
 }
 
@@ -125,7 +170,7 @@ inode_disk_resize (struct inode_disk *inode, int n)
     return false;
 
   int direct_ptr_count = MIN (n, DIRECT_POINTERS);
-  if (!block_arr_resize (inode->direct, direct_ptr_count))
+  if (!block_arr_resize (inode->direct, direct_ptr_count, false, NULL))
     return false;
 
   n -= direct_ptr_count;
@@ -134,7 +179,7 @@ inode_disk_resize (struct inode_disk *inode, int n)
   int indirect_block_count
       = DIV_ROUND_UP (indirect_ptr_count, POINTERS_PER_BLOCK);
 
-  if (!block_arr_resize (inode->indirect, indirect_block_count))
+  if (!block_arr_resize (inode->indirect, indirect_block_count, true, NULL))
     return false;
 
   for (int j = 0; j < indirect_block_count; j++)
@@ -142,9 +187,11 @@ inode_disk_resize (struct inode_disk *inode, int n)
       block_sector_t p[POINTERS_PER_BLOCK];
       cache_read (inode->indirect[j], p);
       int ptr_count = MIN (n, POINTERS_PER_BLOCK);
-      if (!block_arr_resize (p, ptr_count))
+      bool grown = false;
+      if (!block_arr_resize (p, ptr_count, false, &grown))
         return false;
-      cache_write (inode->indirect[j], p);
+      if (grown)
+        cache_write (inode->indirect[j], p);
       n -= ptr_count;
     }
 
@@ -152,7 +199,7 @@ inode_disk_resize (struct inode_disk *inode, int n)
   int iindirect_block_count = DIV_ROUND_UP (
       iindirect_ptr_count, POINTERS_PER_BLOCK * POINTERS_PER_BLOCK);
 
-  if (!block_arr_resize (inode->iindirect, iindirect_block_count))
+  if (!block_arr_resize (inode->iindirect, iindirect_block_count, true, NULL))
     return false;
 
   for (int k = 0; k < iindirect_block_count; k++)
@@ -163,7 +210,8 @@ inode_disk_resize (struct inode_disk *inode, int n)
       int indirect_block_count
           = MIN (DIV_ROUND_UP (n, POINTERS_PER_BLOCK), POINTERS_PER_BLOCK);
 
-      if (!block_arr_resize (pp, indirect_block_count))
+      bool pp_grown = false;
+      if (!block_arr_resize (pp, indirect_block_count, true, &pp_grown))
         return false;
 
       for (int j = 0; j < indirect_block_count; j++)
@@ -171,13 +219,16 @@ inode_disk_resize (struct inode_disk *inode, int n)
           block_sector_t p[POINTERS_PER_BLOCK];
           cache_read (pp[j], p);
           int ptr_count = MIN (n, POINTERS_PER_BLOCK);
-          if (!block_arr_resize (p, ptr_count))
+          bool grown = false;
+          if (!block_arr_resize (p, ptr_count, false, &grown))
             return false;
-          cache_write (pp[j], p);
+          if (grown)
+            cache_write (pp[j], p);
           n -= ptr_count;
         }
 
-      cache_write (inode->iindirect[k], pp);
+      if (pp_grown)
+        cache_write (inode->iindirect[k], pp);
     }
 
   return n == 0;
@@ -212,6 +263,8 @@ inode_reserve (struct inode *inode, int n)
  * @param length
  * @return true if successful.
  * @return false if memory or disk allocation fails.
+ * @note All of `length` is allocated at once, so inside a journal
+ * transaction keep it small and grow the inode with inode_grow later.
  */
 bool
 inode_create (block_sector_t sector, off_t length)
@@ -387,9 +440,11 @@ inode_close (struct inode *inode)
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          journal_begin (inode_close_log_size ());
           cache_write (inode->sector, &inode->data);
           free_map_release (inode->sector, 1);
           inode_disk_close (&inode->data);
+          journal_end ();
         }
       // printf ("close%d\n", inode->sector);
       free (inode);
@@ -475,6 +530,53 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/**
+ * @brief Starts bringing `size` bytes of `inode` at `offset` into the
+ * buffer cache, without waiting for the disk
+ * @param inode the inode to read ahead
+ * @param size the number of bytes wanted soon
+ * @param offset the offset from the beginning of the inode
+ * @note Bytes past the end of the inode are ignored.
+ */
+void
+inode_prefetch (struct inode *inode, off_t size, off_t offset)
+{
+  lock_acquire (&inode->lock);
+  off_t end = MIN (offset + size, inode_length (inode));
+  for (off_t pos = offset - offset % BLOCK_SECTOR_SIZE; pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    cache_prefetch (byte_to_sector (inode, pos));
+  lock_release (&inode->lock);
+}
+
+/**
+ * @brief Extends `inode` to at least `length` bytes
+ * @note The inode grows one bounded journal transaction at a time.  The
+ * transaction is opened before the inode lock is taken, so a thread
+ * waiting for log space never holds an inode lock.  Inside an enclosing
+ * transaction the steps are absorbed into it, so only grow small inodes,
+ * such as directories, there.
+ * @return false if the inode denies writes or the disk is full
+ */
+bool
+inode_grow (struct inode *inode, off_t length)
+{
+  while (inode_length (inode) < length)
+    {
+      journal_begin (inode_grow_log_size ());
+      lock_acquire (&inode->lock);
+      bool success
+          = inode->deny_write_cnt == 0
+            && inode_reserve (inode, MIN (length, inode_length (inode)
+                                                      + INODE_GROW_STEP));
+      lock_release (&inode->lock);
+      journal_end ();
+      if (!success)
+        return false;
+    }
+  return true;
+}
+
 /**
  * @brief Writes `size` bytes from `buffer` into `inode`,
  * starting at `offset`.
@@ -490,17 +592,18 @@ off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
-  lock_acquire (&inode->lock);
-
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
 
+  if (!inode_grow (inode, size + offset))
+    return 0;
+
+  lock_acquire (&inode->lock);
+
   if (inode->deny_write_cnt)
     goto exit;
 
-  if (!inode_reserve (inode, size + offset))
-    return 0;
   ASSERT (inode_length (inode) >= size + offset);
 
   while (size > 0)
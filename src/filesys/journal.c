@@ -0,0 +1,351 @@
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include <debug.h>
+#include <stdint.h>
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Home location of a log sector whose contents must not be replayed,
+   because its home sector has since been reused for file data. */
+#define JOURNAL_REVOKED ((block_sector_t) -1)
+
+/* Timer ticks between commits of an open group. */
+#define JOURNAL_COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* On-disk journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.  Log sectors
+   0..COUNT-1 hold committed transactions, oldest first, whose home
+   locations are SECTORS[0..COUNT-1]. */
+struct journal_header
+{
+  unsigned magic;                /* Magic number. */
+  uint32_t count;                /* Number of logged sectors. */
+  block_sector_t sectors[126];   /* Home location of each log sector. */
+};
+
+/* In-memory copy of the header.  Entries 0..COMMITTED-1 are on disk;
+   entries COMMITTED..COUNT-1 belong to the open group, whose sectors
+   stay pinned in the cache until the group commits. */
+static struct journal_header header;
+static uint32_t committed;           /* Number of committed entries. */
+static bool revoked;                 /* A committed entry was revoked. */
+static uint8_t log_buffer[JOURNAL_SIZE][BLOCK_SECTOR_SIZE]; /* Log staging. */
+static struct lock journal_lock;     /* Protects the fields below. */
+static struct condition journal_cond; /* Signaled when a commit ends. */
+static int outstanding;               /* Number of open transactions. */
+static size_t reserved;               /* Log slots they reserved. */
+static bool committing;               /* A group commit is in progress. */
+
+static void journal_commit (void);
+static void journal_checkpoint (void);
+static thread_func journal_daemon NO_RETURN;
+
+/**
+ * @brief Initializes the journal module and starts the thread that
+ * commits the open group every JOURNAL_COMMIT_INTERVAL ticks.
+ */
+void
+journal_init (void)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+  ASSERT (JOURNAL_SIZE <= sizeof header.sectors / sizeof *header.sectors);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  outstanding = 0;
+  reserved = 0;
+  committing = false;
+  header.magic = JOURNAL_MAGIC;
+  header.count = 0;
+  committed = 0;
+  revoked = false;
+  thread_create ("jcommit", PRI_DEFAULT, journal_daemon, NULL);
+}
+
+/**
+ * @brief Writes an empty journal header to the file system device.
+ */
+void
+journal_format (void)
+{
+  header.count = 0;
+  committed = 0;
+  revoked = false;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/**
+ * @brief Replays the committed but not yet checkpointed transactions,
+ * if any.
+ * @note Must run before any other sector is read through the cache.
+ */
+void
+journal_recover (void)
+{
+  struct journal_header disk;
+
+  block_read (fs_device, JOURNAL_SECTOR, &disk);
+  if (disk.magic != JOURNAL_MAGIC)
+    PANIC ("journal header corrupted, reformat the file system");
+
+  if (disk.count == 0)
+    return;
+
+  ASSERT (disk.count <= JOURNAL_SIZE);
+  block_read_multiple (fs_device, JOURNAL_SECTOR + 1, disk.count, log_buffer);
+  for (uint32_t i = 0; i < disk.count; i++)
+    if (disk.sectors[i] != JOURNAL_REVOKED)
+      block_write (fs_device, disk.sectors[i], log_buffer[i]);
+  journal_format ();
+}
+
+/**
+ * @brief Whether the log and the open group have room for a transaction
+ * reserving `cnt` slots
+ * @note Caller must hold journal_lock.
+ */
+static bool
+journal_has_room (size_t cnt)
+{
+  return header.count + reserved + cnt <= JOURNAL_SIZE
+         && header.count - committed + reserved + cnt <= JOURNAL_GROUP_MAX;
+}
+
+/**
+ * @brief Opens a transaction for the current thread, reserving `cnt` log
+ * slots, the most distinct sectors it may log.
+ * The transaction joins the open group.  Waits while a commit is
+ * running; if the group or the log is full, the group is committed
+ * first, and the log checkpointed once it cannot hold the transaction.
+ * Transactions nest: only the outermost begin/end pair of a thread
+ * counts, so its reservation must cover the nested ones.
+ */
+void
+journal_begin (size_t cnt)
+{
+  struct thread *t = thread_current ();
+  if (t->journal_depth++ > 0)
+    return;
+
+  if (cnt > JOURNAL_GROUP_MAX)
+    PANIC ("journal transaction of %zu sectors is too large", cnt);
+  t->journal_reserved = cnt;
+  t->journal_logged = 0;
+  lock_acquire (&journal_lock);
+  while (committing || !journal_has_room (cnt))
+    {
+      if (committing || outstanding > 0)
+        {
+          cond_wait (&journal_cond, &journal_lock);
+          continue;
+        }
+
+      committing = true;
+      lock_release (&journal_lock);
+      journal_commit ();
+      if (header.count + cnt > JOURNAL_SIZE)
+        journal_checkpoint ();
+      lock_acquire (&journal_lock);
+      committing = false;
+      cond_broadcast (&journal_cond, &journal_lock);
+    }
+  outstanding++;
+  reserved += cnt;
+  lock_release (&journal_lock);
+}
+
+/**
+ * @brief Closes the current thread's transaction.
+ * The transaction is not committed here: it stays in the open group,
+ * which later transactions join until the group is committed by the
+ * commit thread, by journal_begin or by journal_flush.
+ */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  outstanding--;
+  reserved -= t->journal_reserved;
+  /* Reserved log space was freed up. */
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/**
+ * @brief Waits for the open transactions to end and keeps new ones from
+ * starting until journal_release_exclusive.
+ */
+static void
+journal_acquire_exclusive (void)
+{
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  committing = true;
+  while (outstanding > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/**
+ * @brief Lets transactions start again.
+ */
+static void
+journal_release_exclusive (void)
+{
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/**
+ * @brief Commits the open group and installs the whole log, leaving
+ * the log empty.
+ * @note Called before the cache is flushed at shutdown.
+ */
+void
+journal_flush (void)
+{
+  journal_acquire_exclusive ();
+  journal_commit ();
+  journal_checkpoint ();
+  journal_release_exclusive ();
+}
+
+/**
+ * @brief Whether the current thread has an open transaction.
+ */
+bool
+journal_in_transaction (void)
+{
+  return thread_current ()->journal_depth > 0;
+}
+
+/**
+ * @brief Records that `sector` was modified by the current transaction.
+ * Repeated writes of one sector within the open group are absorbed into
+ * a single log slot.
+ * @note Panics if the transaction takes more slots than journal_begin
+ * reserved for it: the extra slots would belong to other transactions,
+ * and writing `sector` unlogged would break the atomicity of this one.
+ */
+void
+journal_record (block_sector_t sector)
+{
+  struct thread *t = thread_current ();
+  ASSERT (journal_in_transaction ());
+
+  lock_acquire (&journal_lock);
+  uint32_t i;
+  for (i = committed; i < header.count; i++)
+    if (header.sectors[i] == sector)
+      break;
+  if (i == header.count)
+    {
+      if (t->journal_logged >= t->journal_reserved)
+        PANIC ("journal transaction overran its %d reserved sectors",
+               t->journal_reserved);
+      ASSERT (header.count < JOURNAL_SIZE);
+      header.sectors[header.count++] = sector;
+      t->journal_logged++;
+    }
+  lock_release (&journal_lock);
+}
+
+/**
+ * @brief Keeps the logged copies of `sector` from being replayed
+ * @note Called when a freed metadata sector is reused for file data,
+ * whose writes are not logged, normally by the transaction allocating
+ * it; formatting allocates outside any transaction, with an empty log.
+ * The revocation reaches the disk with the header of the next commit.
+ */
+void
+journal_revoke (block_sector_t sector)
+{
+  lock_acquire (&journal_lock);
+  for (uint32_t i = 0; i < header.count; i++)
+    if (header.sectors[i] == sector)
+      {
+        header.sectors[i] = JOURNAL_REVOKED;
+        if (i < committed)
+          revoked = true;
+      }
+  lock_release (&journal_lock);
+}
+
+/**
+ * @brief Commits the open group.
+ * Appends the group's sectors to the log in one sequential transfer and
+ * writes the header, the commit point.  The sectors stay dirty in the
+ * cache and reach their home locations by ordinary write-back.
+ * @note No transaction may be open.
+ */
+static void
+journal_commit (void)
+{
+  uint32_t cnt = header.count - committed;
+  if (cnt == 0 && !revoked)
+    return;
+
+  for (uint32_t i = committed; i < header.count; i++)
+    if (header.sectors[i] != JOURNAL_REVOKED)
+      cache_log (header.sectors[i], log_buffer[i]);
+  if (cnt > 0)
+    block_write_multiple (fs_device, JOURNAL_SECTOR + 1 + committed, cnt,
+                          log_buffer[committed]);
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+
+  for (uint32_t i = committed; i < header.count; i++)
+    if (header.sectors[i] != JOURNAL_REVOKED)
+      cache_commit (header.sectors[i]);
+  committed = header.count;
+  revoked = false;
+}
+
+/**
+ * @brief Reclaims the log: writes every committed sector still dirty in
+ * the cache to its home location, then clears the header.
+ * @note No transaction may be open and the group must be committed.
+ */
+static void
+journal_checkpoint (void)
+{
+  ASSERT (committed == header.count);
+  if (header.count == 0)
+    return;
+
+  for (uint32_t i = 0; i < header.count; i++)
+    if (header.sectors[i] != JOURNAL_REVOKED)
+      cache_install (header.sectors[i]);
+  journal_format ();
+}
+
+/**
+ * @brief Commits the open group every JOURNAL_COMMIT_INTERVAL ticks,
+ * bounding how much metadata a crash can lose.
+ * @note Takes the file system lock, which serializes the cache.
+ */
+static void
+journal_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (JOURNAL_COMMIT_INTERVAL);
+      acquire_filesys ();
+      journal_acquire_exclusive ();
+      journal_commit ();
+      journal_release_exclusive ();
+      release_filesys ();
+    }
+}
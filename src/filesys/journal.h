@@ -0,0 +1,26 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include "devices/block.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Write-ahead metadata journal.
+   The journal header lives at JOURNAL_SECTOR and is followed by
+   JOURNAL_SIZE log sectors.  Both are reserved in the free map. */
+#define JOURNAL_SECTOR 2  /* Journal header sector. */
+#define JOURNAL_SIZE 48   /* Number of log sectors after the header. */
+#define JOURNAL_GROUP_MAX 32 /* Max sectors pinned by an uncommitted group. */
+
+void journal_init (void);
+void journal_format (void);
+void journal_recover (void);
+void journal_flush (void);
+
+void journal_begin (size_t cnt);
+void journal_end (void);
+bool journal_in_transaction (void);
+void journal_record (block_sector_t sector);
+void journal_revoke (block_sector_t sector);
+
+#endif /* filesys/journal.h */
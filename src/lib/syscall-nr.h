@@ -28,7 +28,12 @@ enum
   SYS_MKDIR,   /* Create a directory. */
   SYS_READDIR, /* Reads a directory entry. */
   SYS_ISDIR,   /* Tests if a fd represents a directory. */
-  SYS_INUMBER  /* Returns the inode number for a fd. */
+  SYS_INUMBER, /* Returns the inode number for a fd. */
+
+  /* Extensions. */
+  SYS_BLKSTAT, /* Reads a block device's I/O statistics. */
+  SYS_MADVISE, /* Advises the VM of a memory access pattern. */
+  SYS_MSYNC    /* Writes a memory mapping back to its file. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -173,3 +173,21 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+blkstat (const char *device, char *buffer, unsigned size)
+{
+  return syscall3 (SYS_BLKSTAT, device, buffer, size);
+}
+
+int
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+msync (void *addr, unsigned length)
+{
+  return syscall2 (SYS_MSYNC, addr, length);
+}
@@ -12,6 +12,13 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t)-1)
 
+/* Advice for madvise(). */
+#define MADV_NORMAL 0     /* No special treatment. */
+#define MADV_RANDOM 1     /* Pages accessed in random order. */
+#define MADV_SEQUENTIAL 2 /* Pages accessed in sequential order. */
+#define MADV_WILLNEED 3   /* Pages needed soon. */
+#define MADV_DONTNEED 4   /* Pages not needed soon. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -45,4 +52,9 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int blkstat (const char *device, char *buffer, unsigned size);
+int madvise (void *addr, unsigned length, int advice);
+int msync (void *addr, unsigned length);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({'keep' => {'file' => ["\0" x 1024]}});
+pass;
@@ -0,0 +1,38 @@
+/* Creates and removes many more files and directories than the
+   file system journal can hold at once, some large enough to need
+   indirect blocks, so that the log is committed and reclaimed many
+   times and freed metadata sectors are reused for file data.  Then
+   leaves a few behind to be checked after the file system is
+   remounted. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUNDS 60
+
+void
+test_main (void)
+{
+  char file_name[16], dir_name[16];
+  int i;
+
+  msg ("creating and removing %d files and directories", ROUNDS);
+  for (i = 0; i < ROUNDS; i++)
+    {
+      snprintf (file_name, sizeof file_name, "f%d", i);
+      snprintf (dir_name, sizeof dir_name, "d%d", i);
+      if (!create (file_name, i % 10 == 0 ? 80000 : 600))
+        fail ("create \"%s\"", file_name);
+      if (!mkdir (dir_name))
+        fail ("mkdir \"%s\"", dir_name);
+      if (!remove (file_name))
+        fail ("remove \"%s\"", file_name);
+      if (!remove (dir_name))
+        fail ("remove \"%s\"", dir_name);
+    }
+
+  CHECK (mkdir ("keep"), "mkdir \"keep\"");
+  CHECK (create ("keep/file", 1024), "create \"keep/file\"");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-churn) begin
+(journal-churn) creating and removing 60 files and directories
+(journal-churn) mkdir "keep"
+(journal-churn) create "keep/file"
+(journal-churn) end
+EOF
+pass;
@@ -0,0 +1,32 @@
+/* Reads the I/O statistics of the boot disk with blkstat(),
+   measured, whole and truncated, and those of a device that does
+   not exist. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char buf[4096];
+  char small[8];
+  int len;
+
+  CHECK (blkstat ("nodev", buf, sizeof buf) == -1, "blkstat \"nodev\"");
+  CHECK (blkstat ("hda", NULL, 0) >= 0, "blkstat \"hda\" without a buffer");
+
+  len = blkstat ("hda", buf, sizeof buf);
+  CHECK (len >= 0 && strlen (buf) < sizeof buf, "blkstat \"hda\"");
+
+  memset (small, 'x', sizeof small);
+  len = blkstat ("hda", small, sizeof small);
+  if (len < 0 || memchr (small, '\0', sizeof small) == NULL)
+    fail ("truncated blkstat is not null-terminated");
+  if ((size_t) len < sizeof small ? strlen (small) != (size_t) len
+                                  : strlen (small) != sizeof small - 1)
+    fail ("truncated blkstat has the wrong length");
+  CHECK (!memcmp (small, buf, strlen (small)),
+         "truncated blkstat is a prefix of the whole");
+}
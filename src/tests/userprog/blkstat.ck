@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(blkstat) begin
+(blkstat) blkstat "nodev"
+(blkstat) blkstat "hda" without a buffer
+(blkstat) blkstat "hda"
+(blkstat) truncated blkstat is a prefix of the whole
+(blkstat) end
+blkstat: exit(0)
+EOF
+pass;
@@ -0,0 +1,47 @@
+/* Gives each kind of advice for a file mapping with madvise(),
+   checks that bad arguments are refused, then drops a dirty page
+   with MADV_DONTNEED and verifies that it was written back to the
+   file and faults back in with the same contents. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/sample.inc"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  CHECK (madvise (ACTUAL, 4096, MADV_SEQUENTIAL) == 0,
+         "madvise MADV_SEQUENTIAL");
+  CHECK (madvise (ACTUAL, 4096, MADV_RANDOM) == 0, "madvise MADV_RANDOM");
+  CHECK (madvise (ACTUAL, 4096, MADV_NORMAL) == 0, "madvise MADV_NORMAL");
+  CHECK (madvise (ACTUAL, 4096, MADV_WILLNEED) == 0,
+         "madvise MADV_WILLNEED");
+  CHECK (madvise ((char *) ACTUAL + 1, 4096, MADV_NORMAL) == -1,
+         "madvise misaligned address");
+  CHECK (madvise (ACTUAL, 4096, MADV_DONTNEED + 1) == -1,
+         "madvise bad advice");
+
+  memcpy (ACTUAL, sample, strlen (sample));
+  CHECK (madvise (ACTUAL, 4096, MADV_DONTNEED) == 0,
+         "madvise MADV_DONTNEED");
+
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapped data against written data");
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) create "sample.txt"
+(mmap-madvise) open "sample.txt"
+(mmap-madvise) mmap "sample.txt"
+(mmap-madvise) madvise MADV_SEQUENTIAL
+(mmap-madvise) madvise MADV_RANDOM
+(mmap-madvise) madvise MADV_NORMAL
+(mmap-madvise) madvise MADV_WILLNEED
+(mmap-madvise) madvise misaligned address
+(mmap-madvise) madvise bad advice
+(mmap-madvise) madvise MADV_DONTNEED
+(mmap-madvise) compare read data against written data
+(mmap-madvise) compare mapped data against written data
+(mmap-madvise) end
+EOF
+pass;
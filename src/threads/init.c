@@ -34,6 +34,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -131,6 +133,8 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init ();
+  stripe_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
   dir_init ();
@@ -164,16 +168,60 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID leaf 1 feature flags in EDX.
+   See [IA32-v2a] "CPUID--CPU Identification". */
+#define CPUID_PSE 0x00000008 /* Page Size Extension. */
+#define CPUID_PGE 0x00002000 /* Page Global Enable. */
+
+/* CR4 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR4_PSE 0x00000010 /* Page Size Extensions. */
+#define CR4_PGE 0x00000080 /* Page Global Enable. */
+
+/* Returns the feature flags CPUID reports in EDX. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return edx;
+}
+
+/* Sets BITS in control register CR4. */
+static void
+cr4_enable (uint32_t bits)
+{
+  uint32_t cr4;
+  asm volatile ("movl %%cr4, %0" : "=r"(cr4));
+  asm volatile ("movl %0, %%cr4" : : "r"(cr4 | bits) : "memory");
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   The kernel mappings are global.  If the CPU supports it,
+   global pages are enabled, so that switching to another page
+   directory keeps the kernel's TLB entries.
+
+   If the CPU supports 4 MB pages, each 4 MB stretch of RAM that
+   holds no kernel text is mapped by a single page directory
+   entry.  That needs no page table and takes one TLB entry
+   instead of 1,024.  Kernel text keeps 4 kB pages, so that it
+   can stay read-only. */
 static void
 paging_init (void)
 {
   union entry_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features ();
+  bool large = (features & CPUID_PSE) != 0;
+
+  /* Page directory entries with the PS bit set are only
+     understood once PSE is on. */
+  if (large)
+    cr4_enable (CR4_PSE);
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -185,6 +233,15 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (large && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true);
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx].val == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -200,6 +257,11 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r"(vtop (init_page_dir)));
+
+  /* Turn on global pages only now, so that none of the loader's
+     mappings stays in the TLB. */
+  if (features & CPUID_PGE)
+    cr4_enable (CR4_PGE);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -261,6 +323,24 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          if (value == NULL || atoi (value) <= 0
+              || !ramdisk_configure (atoi (value)))
+            PANIC ("bad RAM disk size `%s'", value ? value : "");
+        }
+      else if (!strcmp (name, "-stripe"))
+        {
+          if (!stripe_configure (value))
+            PANIC ("bad striped device `%s'", value ? value : "");
+        }
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !block_set_default_scheduler (value))
+            PANIC ("unknown I/O scheduler `%s'", value ? value : "");
+        }
+      else if (!strcmp (name, "-iostat"))
+        block_iostat = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -385,6 +465,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Add a KB kB RAM disk (ram0, ram1, ...), to use\n"
+          "                     with -filesys, -scratch or -swap.\n"
+          "  -stripe=DEV,DEV[,...][:CHUNK]\n"
+          "                     Stripe DEVs into a RAID-0 device (md0, md1,\n"
+          "                     ...) with CHUNK-sector chunks (default 16).\n"
+          "  -iosched=NAME      Use I/O scheduler NAME (noop, deadline,\n"
+          "                     elevator) for block devices.\n"
+          "  -iostat            Print block I/O latencies and traces at\n"
+          "                     shutdown.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
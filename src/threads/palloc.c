@@ -1,4 +1,5 @@
 #include "threads/palloc.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,6 +33,8 @@ struct pool
   struct lock lock;        /* Mutual exclusion. */
   struct bitmap *used_map; /* Bitmap of free pages. */
   uint8_t *base;           /* Base of pool. */
+  size_t free_cnt;         /* Number of free pages, updated with
+                              interrupts off. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -85,8 +88,20 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    {
+      /* Freeing does not take the lock, see palloc_free_multiple(). */
+      enum intr_level old_level = intr_disable ();
+      pool->free_cnt -= page_cnt;
+      intr_set_level (old_level);
+    }
   lock_release (&pool->lock);
 
+#ifdef VM
+  if (pool == &user_pool)
+    frame_check_free ();
+#endif
+
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
@@ -124,8 +139,29 @@ palloc_get_page (enum palloc_flags flags)
 
 #ifdef VM
 
+/**
+ * @brief the number of pages in the user pool
+ */
+size_t
+palloc_user_page_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/**
+ * @brief the number of free pages in the user pool
+ * @note the count may be stale by the time it is used
+ */
+size_t
+palloc_user_free_cnt (void)
+{
+  return user_pool.free_cnt;
+}
+
 /**
  * @brief force obtain a page by eviction if necessary
+ * @note the page-out thread normally keeps free pages around; eviction
+ * only happens here when it has fallen behind
  * @param flags
  * @return the pointer to the page obtained
  */
@@ -171,8 +207,15 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  /* No lock here: thread_schedule_tail() frees a dying thread's
+     page with interrupts off, where sleeping is not allowed.  The
+     bitmap updates are atomic, and the free count is only changed
+     with interrupts off. */
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt += page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -206,6 +249,7 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
 }
 
 /**
@@ -71,6 +71,14 @@ pd_no (const void *va)
    The important flags are listed below.
    When a PDE or PTE is not "present", the other flags are
    ignored.
+
+   A PDE marked "large" maps a 4 MB page directly instead of
+   pointing to a page table, provided CR4.PSE is set.  The
+   physical address of such a page must be 4 MB aligned.
+
+   A PTE marked "global" stays in the TLB when CR3 is reloaded,
+   provided CR4.PGE is set.  Only kernel pages, which are mapped
+   alike in every page directory, may be global.
    A PDE or PTE that is initialized to 0 will be interpreted as
    "not present", which is just fine. */
 
@@ -84,7 +92,8 @@ union entry_t
     uint32_t _reserved_0 : 2;
     uint32_t accessed : 1;
     uint32_t dirty : 1;
-    uint32_t _reserved_1 : 2;
+    uint32_t large : 1;
+    uint32_t global : 1;
     uint32_t available : 3;
     uint32_t physical_address : 20;
   };
@@ -109,13 +118,31 @@ static inline union entry_t *
 pde_get_pt (union entry_t pde)
 {
   ASSERT (pde.present);
+  ASSERT (!pde.large);
   return ptov (pde.physical_address << 12);
 }
 
+/* Returns a PDE that maps the 4 MB page at PAGE, which must be
+   4 MB aligned.  The page is readable, and writable as well if
+   WRITABLE is true.  Like the pages of pte_create_kernel(), it
+   is usable only by the kernel and global. */
+static inline union entry_t
+pde_create_large (void *page, bool writable)
+{
+  ASSERT (((uintptr_t)page & (PTSPAN - 1)) == 0);
+  union entry_t pde = { .val = vtop (page) };
+  pde.present = 1;
+  pde.writable = writable;
+  pde.large = 1;
+  pde.global = 1;
+  return pde;
+}
+
 /* Returns a PTE that points to PAGE.
    The PTE's page is readable.
    If WRITABLE is true then it will be writable as well.
-   The page will be usable only by ring 0 code (the kernel). */
+   The page will be usable only by ring 0 code (the kernel), and
+   is global, so context switches keep its TLB entry. */
 static inline union entry_t
 pte_create_kernel (void *page, bool writable)
 {
@@ -123,6 +150,7 @@ pte_create_kernel (void *page, bool writable)
   union entry_t pte = { .val = vtop (page) };
   pte.present = 1;
   pte.writable = writable;
+  pte.global = 1;
   return pte;
 }
 
@@ -135,6 +163,7 @@ pte_create_user (void *page, bool writable)
 {
   union entry_t pte = pte_create_kernel (page, writable);
   pte.user = 1;
+  pte.global = 0;
   return pte;
 }
 
@@ -209,10 +209,6 @@ thread_create (const char *name, int priority, thread_func *function,
   /* Add to run queue. */
   thread_unblock (t);
 
-#ifdef VM
-  cur_frame_table_init (&t->frame_table);
-#endif
-
   return tid;
 }
 
@@ -657,6 +653,11 @@ init_thread (struct thread *t, const char *name, int priority)
 #ifdef VM
   t->esp = NULL;
   t->mapid = 0;
+  t->frame_table = NULL;
+  t->vma_root = NULL;
+  t->ra_window = READAHEAD_MIN;
+  t->ra_hits = 0;
+  t->ra_last_fault = NULL;
 #endif
 
   enum intr_level old_level = intr_disable ();
@@ -31,6 +31,8 @@ typedef int tid_t;
 
 #ifdef USERPROG
 struct process;
+struct vma;
+struct spt;
 #endif
 
 /* A kernel thread or user process.
@@ -117,13 +119,20 @@ struct thread
 #endif
 
 #ifdef VM
-  struct hash frame_table; /* Supplemental page table */
+  struct spt *frame_table; /* Supplemental page table */
+  struct vma *vma_root;     /* Tree of regions mapped from files */
   void *esp; /* save sp when calling syscall, NULL when not in syscall */
   int mapid; /* mapid */
+  unsigned ra_window;  /* Swap read-ahead window, in pages */
+  unsigned ra_hits;    /* Read-ahead pages used since the last swap-in */
+  void *ra_last_fault; /* Page of the last swap-in */
 #endif
 
 #ifdef FILESYS
   struct dir *cwd;
+  int journal_depth; /* Nesting depth of open journal transactions */
+  int journal_reserved; /* Log slots reserved by the open transaction */
+  int journal_logged; /* Log slots taken by the open transaction */
 #endif
 
   /* Owned by thread.c. */
@@ -6,8 +6,8 @@
 #include <stddef.h>
 #include <string.h>
 
-static union entry_t *active_pd (void);
 static void invalidate_pagedir (union entry_t *);
+static void invalidate_page (union entry_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -152,7 +152,7 @@ pagedir_clear_page (union entry_t *pd, void *upage)
   if (pte != NULL && pte->present)
     {
       pte->present = 0;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -180,7 +180,7 @@ pagedir_set_dirty (union entry_t *pd, const void *vpage, bool dirty)
       else
         {
           pte->dirty = 0;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,11 +209,73 @@ pagedir_set_accessed (union entry_t *pd, const void *vpage, bool accessed)
       else
         {
           pte->accessed = 0;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Initializes BATCH to hold no pages. */
+void
+pagedir_batch_init (struct pagedir_batch *batch)
+{
+  batch->pd = NULL;
+  batch->cnt = 0;
+}
+
+/* Clears the accessed bit in the PTE for virtual page VPAGE in
+   PD, like pagedir_set_accessed (PD, VPAGE, false), but queues
+   the TLB invalidation in BATCH until pagedir_batch_flush().
+
+   Only the accessed bit may be cleared this way: until the flush
+   the CPU may keep using a stale TLB entry, which at worst lets
+   a page look idle while it is in use.  A clock sweep clears the
+   bit on many pages in a row and so invalidates them at once. */
+void
+pagedir_clear_accessed (union entry_t *pd, const void *vpage,
+                        struct pagedir_batch *batch)
+{
+  union entry_t *pte = lookup_page (pd, vpage, false);
+  if (pte == NULL || !pte->accessed)
+    return;
+
+  pte->accessed = 0;
+  if (pagedir_active () != pd)
+    return;
+
+  /* The batch only tracks the active page directory, whose
+     entries are the only ones that can be in the TLB. */
+  if (batch->pd != pd)
+    {
+      pagedir_batch_flush (batch);
+      batch->pd = pd;
+    }
+  if (batch->cnt < PAGEDIR_BATCH_MAX)
+    batch->pages[batch->cnt] = vpage;
+  batch->cnt++;
+}
+
+/* Invalidates the TLB entries of the pages queued in BATCH and
+   empties it.  Reloads the whole page directory instead if more
+   pages were queued than BATCH can hold. */
+void
+pagedir_batch_flush (struct pagedir_batch *batch)
+{
+  if (batch->pd == NULL)
+    return;
+
+  /* After a switch to another page directory the queued entries
+     are gone from the TLB already. */
+  if (pagedir_active () == batch->pd)
+    {
+      if (batch->cnt > PAGEDIR_BATCH_MAX)
+        invalidate_pagedir (batch->pd);
+      else
+        for (size_t i = 0; i < batch->cnt; i++)
+          invalidate_page (batch->pd, batch->pages[i]);
+    }
+  pagedir_batch_init (batch);
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -231,8 +293,8 @@ pagedir_activate (union entry_t *pd)
 }
 
 /* Returns the currently active page directory. */
-static union entry_t *
-active_pd (void)
+union entry_t *
+pagedir_active (void)
 {
   /* Copy CR3, the page directory base register (PDBR), into
      `pd'.
@@ -254,10 +316,24 @@ active_pd (void)
 static void
 invalidate_pagedir (union entry_t *pd)
 {
-  if (active_pd () == pd)
+  if (pagedir_active () == pd)
     {
       /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
       pagedir_activate (pd);
     }
 }
+
+/* Invalidates the TLB entry for virtual page VPAGE if PD is the
+   active page directory.  Cheaper than invalidate_pagedir() when
+   a single page table entry changed, since the rest of the TLB
+   stays intact. */
+static void
+invalidate_page (union entry_t *pd, const void *vpage)
+{
+  if (pagedir_active () == pd)
+    {
+      /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+      asm volatile ("invlpg (%0)" : : "r"(vpage) : "memory");
+    }
+}
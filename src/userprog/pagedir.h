@@ -2,9 +2,21 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <threads/pte.h>
 
+/* Most pages whose TLB invalidation a batch queues individually. */
+#define PAGEDIR_BATCH_MAX 32
+
+/* TLB invalidations deferred by pagedir_clear_accessed(). */
+struct pagedir_batch
+  {
+    union entry_t *pd;                    /* Page directory, if any. */
+    size_t cnt;                           /* Number of pages queued. */
+    const void *pages[PAGEDIR_BATCH_MAX]; /* Pages queued. */
+  };
+
 union entry_t *pagedir_create (void);
 void pagedir_destroy (union entry_t *pd);
 bool pagedir_set_page (union entry_t *pd, void *upage, void *kpage, bool rw);
@@ -15,6 +27,11 @@ void pagedir_set_dirty (union entry_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (union entry_t *pd, const void *upage);
 void pagedir_set_accessed (union entry_t *pd, const void *upage,
                            bool accessed);
+void pagedir_batch_init (struct pagedir_batch *);
+void pagedir_clear_accessed (union entry_t *pd, const void *upage,
+                             struct pagedir_batch *);
+void pagedir_batch_flush (struct pagedir_batch *);
 void pagedir_activate (union entry_t *pd);
+union entry_t *pagedir_active (void);
 
 #endif /* userprog/pagedir.h */
@@ -23,6 +23,7 @@
 #ifdef VM
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/vma.h"
 #endif
 
 #define PROCESS_MAGIC 0x636f7270
@@ -94,6 +95,9 @@ init_process (struct process *process, struct thread *thread)
   list_init (&process->files);
   list_init (&process->mmapped_files);
   list_init (&process->dirs);
+#ifdef VM
+  process->exec_file = NULL;
+#endif
   sema_init (&process->wait_sema, 0);
   sema_init (&process->elf_load_sema, 0);
   sema_init (&process->exec_sama, 0);
@@ -296,21 +300,6 @@ process_close_all_files (struct list *files)
     }
 }
 
-#ifdef VM
-
-static void
-page_destroy_action (struct hash_elem *e, void *aux)
-{
-  struct fte *fte = hash_entry (e, struct fte, cur_frame_table_elem);
-  struct thread *t = thread_current ();
-
-  ASSERT (&t->frame_table == aux);
-  /// Warning: deleting while iterating
-  fte_destroy (fte);
-}
-
-#endif
-
 static void
 process_close_all_dirs (struct list *dirs)
 {
@@ -372,7 +361,16 @@ process_exit (void)
       file_close (mmap_file);
     }
 
-  hash_destroy (&t->frame_table, page_destroy_action);
+  // the executable backs the pages of its segments
+  if (p->exec_file != NULL)
+    {
+      mmap_destroy (p->exec_file->mmap_entry, fte_destroy);
+      file_close (p->exec_file);
+      p->exec_file = NULL;
+    }
+
+  spt_destroy (t->frame_table, fte_destroy);
+  t->frame_table = NULL;
 #endif
   release_filesys ();
 
@@ -411,8 +409,12 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  Reloading CR3 flushes the
+     TLB, so skip it when the page directory is active already.
+     A kernel thread only touches kernel mappings, which every
+     page directory has, so it keeps whichever one is active. */
+  if (t->pagedir != NULL && t->pagedir != pagedir_active ())
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -507,6 +509,11 @@ load_entry (struct file *file, void (**eip) (void), void **esp)
   if (t->pagedir == NULL)
     goto done;
   process_activate ();
+#ifdef VM
+  t->frame_table = spt_create ();
+  if (t->frame_table == NULL)
+    goto done;
+#endif
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -602,8 +609,15 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (file == NULL)
     goto done;
   file_deny_write (file);
+#ifdef VM
+  /* The segments are paged in from FILE, keep it until exit. */
+  mmap_create (file, MAP_FAILED, true);
+  p->exec_file = file;
+  success = load_entry (file, eip, esp);
+#else
   success = load_entry (file, eip, esp);
   list_push_back (&p->files, &file->elem);
+#endif
 done:
   release_filesys ();
   return success;
@@ -680,6 +694,16 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Map the segment as a region of FILE, each page is read on its
+     first fault.  Read-only pages stay backed by FILE and are read
+     again after eviction; writable ones become anonymous memory once
+     loaded. */
+  return vma_create (file->mmap_entry, upage,
+                     (read_bytes + zero_bytes) / PGSIZE, ofs, read_bytes,
+                     writable)
+         != NULL;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0)
     {
@@ -689,19 +713,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-/* Get a page of memory. */
-#ifdef VM
-      struct fte *fte = fte_create (upage, writable);
-      uint8_t *kpage = fte->kpage;
-
-      /* Load process page */
-      if (file_read (file, kpage, page_read_bytes) != (int)page_read_bytes)
-        {
-          palloc_free_page (kpage);
-          return false;
-        }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
-#else
+      /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
         return false;
@@ -720,7 +732,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false;
         }
-#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -728,6 +739,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
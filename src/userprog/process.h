@@ -19,6 +19,10 @@ struct process
 
   struct list dirs; /* dirs opened by this thread */
 
+#ifdef VM
+  struct file *exec_file; /* Executable, backs the loaded segments. */
+#endif
+
   struct list child_list; /* List of child processes. */
   /// TODO: use hash table to store child processes
 
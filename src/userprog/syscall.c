@@ -10,10 +10,12 @@
 #include "threads/vaddr.h"
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/vma.h"
 #include <filesys/directory.h>
 #include <filesys/file.h>
 #include <filesys/filesys.h>
 #include <filesys/inode.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include <syscall-nr.h>
@@ -21,6 +23,11 @@
 
 #define __user
 
+#ifdef VM
+/* Most bytes of a user buffer pinned at once by read and write. */
+#define PIN_CHUNK (16 * PGSIZE)
+#endif
+
 /**
  * @brief Read a byte at user virtual address `uaddr`.
  * @note `udst` must be below PHYS_BASE.
@@ -71,6 +78,12 @@ copy_from_user (uint8_t *dst, const uint8_t __user *src, size_t size)
   if (src + size >= PHYS_BASE)
     return false;
 
+#ifdef VM
+  if (!frame_pin (src, size, false))
+    return false;
+  memcpy (dst, src, size);
+  frame_unpin (src, size);
+#else
   for (size_t i = 0; i < size; i++)
     {
       int byte = try_load (src + i);
@@ -78,6 +91,7 @@ copy_from_user (uint8_t *dst, const uint8_t __user *src, size_t size)
         return false;
       dst[i] = byte;
     }
+#endif
   return true;
 }
 
@@ -87,9 +101,16 @@ copy_to_user (uint8_t __user *dst, const uint8_t *src, size_t size)
   if (dst + size >= PHYS_BASE)
     return false;
 
+#ifdef VM
+  if (!frame_pin (dst, size, true))
+    return false;
+  memcpy (dst, src, size);
+  frame_unpin (dst, size);
+#else
   for (size_t i = 0; i < size; i++)
     if (!try_store (dst + i, src[i]))
       return false;
+#endif
   return true;
 }
 
@@ -162,6 +183,71 @@ user_access_validate_string (const char __user *str)
   while (byte != 0);
 }
 
+#ifndef VM
+/**
+ * @brief check if `size` bytes from `uaddr` are writable by user, if not then
+ * exit(-1)
+ * @note every page is probed by storing back the byte it holds, so the
+ * buffer is left intact
+ * @param uaddr
+ * @param size
+ */
+static void
+user_access_validate_writable (uint8_t __user *uaddr, size_t size)
+{
+  if (size == 0)
+    return;
+  if (uaddr + size >= (uint8_t *)PHYS_BASE)
+    sys_exit (-1);
+
+  uint8_t *last = pg_round_down (uaddr + size - 1);
+  for (uint8_t *p = uaddr; p <= last; p = pg_round_down (p) + PGSIZE)
+    {
+      int byte = try_load (p);
+      if (byte == -1 || !try_store (p, byte))
+        sys_exit (-1);
+    }
+}
+#else
+/**
+ * @brief read or write `file` through a user buffer, pinning at most
+ * PIN_CHUNK bytes of it at a time, if the buffer is invalid then exit(-1)
+ * @param file
+ * @param buffer
+ * @param size
+ * @param write true to write `buffer` to `file`, false to read into it
+ * @return the number of bytes read or written
+ * @note The file system lock is held only while the chunk is pinned, so
+ * copying never faults under it.
+ */
+static int
+file_io_pinned (struct file *file, uint8_t __user *buffer, unsigned size,
+                bool write)
+{
+  int done = 0;
+  while (size > 0)
+    {
+      unsigned chunk = PIN_CHUNK - pg_ofs (buffer);
+      if (chunk > size)
+        chunk = size;
+      if (!frame_pin (buffer, chunk, !write))
+        sys_exit (-1);
+      acquire_filesys ();
+      int bytes = write ? file_write (file, buffer, chunk)
+                        : file_read (file, buffer, chunk);
+      release_filesys ();
+      frame_unpin (buffer, chunk);
+
+      done += bytes;
+      if ((unsigned)bytes < chunk)
+        break;
+      buffer += bytes;
+      size -= bytes;
+    }
+  return done;
+}
+#endif
+
 /**
  * @brief check if `fd` represents a file of this thread, if not then exit(-1)
  * @param fd
@@ -251,41 +337,20 @@ sys_mmap (int fd, void *addr)
   if (size == 0)
     return MAP_FAILED;
 
-  // check the overlap
+  // check the overlap with the stack, other regions are checked below
   struct thread *cur = thread_current ();
-  int page_cnt = (size - 1) / PGSIZE + 1;
-  for (int i = 0; i < page_cnt; i++)
-    {
-      void *upage = addr + i * PGSIZE;
-      if (cur_frame_table_find (upage) != NULL)
-        return MAP_FAILED;
-    }
-
-  cur->mapid++;
-
-  // create mmap_entry
-  file->mmap_entry = malloc (sizeof (struct mmap_entry));
-  file->mmap_entry->mapid = cur->mapid;
-  file->mmap_entry->file = file;
-  list_init (&file->mmap_entry->fte_list);
+  size_t page_cnt = (size - 1) / PGSIZE + 1;
+  if ((uintptr_t)addr + page_cnt * PGSIZE > (uintptr_t)PHYS_BASE - STACK_MAX)
+    return MAP_FAILED;
 
-  off_t ofs = 0;
-  // create mmap
-  while (size > 0)
+  // create mmap_entry and its region, pages are attached on fault
+  struct mmap_entry *mmap_entry = mmap_create (file, cur->mapid + 1, false);
+  if (vma_create (mmap_entry, addr, page_cnt, 0, size, true) == NULL)
     {
-      size_t page_read_bytes = size < PGSIZE ? size : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      // create a fte
-      ASSERT (file->mmap_entry != NULL);
-      struct fte *fte = fte_attach_to_file (file, ofs, addr, true);
-      if (fte == NULL)
-        return MAP_FAILED;
-
-      size -= page_read_bytes;
-      addr += PGSIZE;
-      ofs += PGSIZE;
+      mmap_destroy (mmap_entry, fte_destroy);
+      return MAP_FAILED;
     }
+  cur->mapid++;
 
   // move the file from normal file list to mmapped file list
   list_remove (&file->elem);
@@ -304,17 +369,58 @@ sys_munmap (int mapping)
       struct file *mmap_file = list_entry (e, struct file, elem);
       ASSERT (is_file (mmap_file));
       struct mmap_entry *mmap_entry = mmap_file->mmap_entry;
-      e = list_remove (e);
-      list_push_back (&cur->files, &mmap_file->elem);
+      e = list_next (e);
 
       if (mmap_entry->mapid == mapping)
         {
+          list_remove (&mmap_file->elem);
+          list_push_back (&cur->files, &mmap_file->elem);
           // iterate the fte list and destroy
           mmap_destroy (mmap_entry, fte_destroy);
         }
     }
 }
 
+/**
+ * @brief Checks a page-aligned user range for madvise() and msync()
+ * @param end receives the page after the range
+ * @return whether the range is valid
+ */
+static bool
+user_range_aligned (void *addr, unsigned length, void **end)
+{
+  if (pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+    return false;
+  uintptr_t last = (uintptr_t)addr + ROUND_UP (length, PGSIZE);
+  if (last < (uintptr_t)addr || last > (uintptr_t)PHYS_BASE)
+    return false;
+  *end = (void *)last;
+  return true;
+}
+
+static int
+sys_madvise (void *addr, unsigned length, int advice)
+{
+  void *end;
+  if (!user_range_aligned (addr, length, &end) || advice < MADV_NORMAL
+      || advice > MADV_DONTNEED)
+    return -1;
+  if (addr < end)
+    vma_advise (addr, end, advice);
+  return 0;
+}
+
+static int
+sys_msync (void *addr, unsigned length)
+{
+  void *end;
+  if (!user_range_aligned (addr, length, &end))
+    return -1;
+  if (addr < end)
+    vma_sync (addr, end);
+  return 0;
+}
+
 #endif
 
 static bool
@@ -436,24 +542,31 @@ sys_read (int fd, uint8_t __user *buffer, unsigned size)
   if (!is_user_vaddr (buffer) || !is_user_vaddr (buffer + size - 1))
     sys_exit (-1);
 
-  // stdin
+  // stdin, each key stored once it is typed, since waiting for one
+  // must not keep the buffer pinned
   if (fd == STDIN_FILENO)
     {
       unsigned i;
       for (i = 0; i < size; i++)
-        buffer[i] = input_getc ();
+        {
+          uint8_t key = input_getc ();
+          if (!copy_to_user (buffer + i, &key, 1))
+            sys_exit (-1);
+        }
       return i;
     }
 
   // file
   struct file *file = file_owner_validate (fd);
-  for (unsigned i = 0; i < size; i += PGSIZE)
-    buffer[i] = 0;
-  buffer[size - 1] = 0;
+#ifdef VM
+  return file_io_pinned (file, buffer, size, false);
+#else
+  user_access_validate_writable (buffer, size);
   acquire_filesys ();
   int bytes_read = file_read (file, buffer, size);
   release_filesys ();
   return bytes_read;
+#endif
 }
 
 static int
@@ -461,19 +574,40 @@ sys_write (int fd, const char __user *buffer, unsigned size)
 {
   user_access_validate (buffer, size);
 
-  // stdout
+  // stdout, through a bounce buffer so that the console lock is never
+  // held across a page fault; a write of up to a page is not interleaved
   if (fd == STDOUT_FILENO)
     {
-      putbuf (buffer, size);
+      size_t alloc = size < PGSIZE ? size : PGSIZE;
+      char *bounce = malloc (alloc > 0 ? alloc : 1);
+      if (bounce == NULL)
+        return -1;
+      for (unsigned done = 0; done < size; done += alloc)
+        {
+          if (alloc > size - done)
+            alloc = size - done;
+          if (!copy_from_user ((uint8_t *)bounce,
+                               (const uint8_t *)buffer + done, alloc))
+            {
+              free (bounce);
+              sys_exit (-1);
+            }
+          putbuf (bounce, alloc);
+        }
+      free (bounce);
       return size;
     }
 
   // file
   struct file *file = file_owner_validate (fd);
+#ifdef VM
+  return file_io_pinned (file, (uint8_t *)buffer, size, true);
+#else
   acquire_filesys ();
   int bytes_written = file_write (file, buffer, size);
   release_filesys ();
   return bytes_written;
+#endif
 }
 
 static bool
@@ -501,9 +635,13 @@ sys_readdir (int fd, char __user *name)
   struct dir *dir = dir_get (fd);
   if (dir == NULL)
     return false;
+  char kname[READDIR_MAX_LEN + 1];
   acquire_filesys ();
-  bool success = dir_readdir (dir, name);
+  bool success = dir_readdir (dir, kname);
   release_filesys ();
+  if (success
+      && !copy_to_user ((uint8_t *)name, (uint8_t *)kname, strlen (kname) + 1))
+    sys_exit (-1);
   return success;
 }
 
@@ -531,6 +669,41 @@ sys_inumber (int fd)
   sys_exit (-1); // neither file nor dir
 }
 
+/**
+ * @brief format the I/O statistics of a block device into a user buffer
+ * @param device name of the block device, e.g. "hda"
+ * @param buffer the buffer to fill, null-terminated if `size` is nonzero
+ * @param size size of `buffer`; at most a page of text is copied
+ * @return length of the full statistics text, which may exceed `size`, or
+ * -1 if there is no such device
+ */
+static int
+sys_blkstat (const char __user *device, char __user *buffer, unsigned size)
+{
+  user_access_validate_string (device);
+  if (size > 0)
+    user_access_validate (buffer, size);
+
+  struct block *block = block_get_by_name (device);
+  if (block == NULL)
+    return -1;
+
+  // formatted once, straight into a kernel buffer bounded by `size`; a
+  // null buffer would print the text instead of measuring it
+  size_t alloc = size == 0 ? 1 : size < PGSIZE ? size : PGSIZE;
+  char *text = malloc (alloc);
+  if (text == NULL)
+    return -1;
+  size_t len = block_format_stats (block, text, alloc);
+  size_t copied = len < alloc ? len : alloc - 1;
+  bool ok = size == 0
+            || copy_to_user ((uint8_t *)buffer, (uint8_t *)text, copied + 1);
+  free (text);
+  if (!ok)
+    sys_exit (-1);
+  return len;
+}
+
 /*************************/
 /* System call interface */
 /*************************/
@@ -592,6 +765,12 @@ syscall_handler (struct intr_frame *f)
     case SYS_MUNMAP:
       sys_munmap (argv[1]);
       break;
+    case SYS_MADVISE:
+      f->eax = sys_madvise (argv[1], argv[2], argv[3]);
+      break;
+    case SYS_MSYNC:
+      f->eax = sys_msync (argv[1], argv[2]);
+      break;
 #endif
     case SYS_CHDIR:
       f->eax = sys_chdir (argv[1]);
@@ -608,6 +787,9 @@ syscall_handler (struct intr_frame *f)
     case SYS_INUMBER:
       f->eax = sys_inumber (argv[1]);
       break;
+    case SYS_BLKSTAT:
+      f->eax = sys_blkstat (argv[1], argv[2], argv[3]);
+      break;
     default:
       sys_exit (-1);
     }
@@ -1,4 +1,7 @@
 #include "frame.h"
+#include "page.h"
+#include "share.h"
+#include "vma.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/off_t.h"
@@ -12,6 +15,34 @@ struct lock frame_clock_list_lock;
 static struct list clock_list; // a cycle list for clock algorithm
 static struct list_elem *clock_list_iterator;
 
+/* Sweeps of the clock before giving up on finding a victim: one for
+   clean frames, one clearing accessed bits and one to take a frame
+   whose bit stayed clear. */
+#define CLOCK_SWEEPS 3
+
+/* Most swapped pages held in read-ahead frames at once. */
+#define READAHEAD_LIMIT 64
+
+// swapped pages read ahead but not mapped yet, oldest first
+static struct list readahead_list;
+static size_t readahead_cnt;
+static struct lock readahead_lock; // protects the above and fte->ra_kpage
+
+static bool readahead_reclaim (void);
+static bool page_is_zero (const void *kpage);
+
+/* Free user frame watermarks.  The page-out thread is woken once
+   fewer than pageout_low frames are free and evicts ahead of demand
+   until pageout_high frames are free, so that page faults rarely
+   have to evict on their own. */
+static size_t pageout_low, pageout_high;
+static bool pageout_started;       // page-out thread running?
+static bool pageout_idle;          // page-out thread waiting for work?
+static struct lock pageout_lock;   // protects pageout_idle
+static struct condition pageout_cond; // signaled to wake the thread
+
+static void pageout_thread (void *aux);
+
 static void
 clock_list_next (void)
 {
@@ -29,6 +60,7 @@ static void
 clock_list_push_back (struct list_elem *elem)
 {
   lock_acquire (&frame_clock_list_lock);
+  list_entry (elem, struct fte, clock_list_elem)->on_clock = true;
   if (list_empty (&clock_list))
     {
       clock_list_iterator = elem;
@@ -40,24 +72,132 @@ clock_list_push_back (struct list_elem *elem)
 }
 
 /**
- * @brief Clock list remove
+ * @brief Clock list remove, if the frame is on it
  * @param elem the elem in struct fte
+ * @note The caller holds the frame's lock.  A frame off the list then is
+ * not resident: an eviction in progress holds the lock until it is done.
  * @note This function gaurentees thread safety
  */
 static void
 clock_list_remove (struct list_elem *elem)
 {
   ASSERT (elem != NULL);
-  ASSERT (!list_empty (&clock_list));
+  struct fte *fte = list_entry (elem, struct fte, clock_list_elem);
+  ASSERT (lock_held_by_current_thread (&fte->lock));
+
   lock_acquire (&frame_clock_list_lock);
-  if (clock_list_iterator == elem)
-    clock_list_next ();
-  list_remove (elem);
+  if (fte->on_clock)
+    {
+      if (clock_list_iterator == elem)
+        clock_list_next ();
+      list_remove (elem);
+      fte->on_clock = false;
+    }
   lock_release (&frame_clock_list_lock);
 }
 
+/**
+ * @brief Take a frame off the clock list and lock it, unless it is busy
+ * @param fte the frame
+ * @return true if `fte` was on the clock list and is now locked and off it
+ * @note A frame off the list is being evicted or is not resident.
+ */
+static bool
+clock_list_take (struct fte *fte)
+{
+  bool taken = false;
+  lock_acquire (&frame_clock_list_lock);
+  if (fte->on_clock && lock_try_acquire (&fte->lock))
+    {
+      if (fte->pinned > 0)
+        {
+          lock_release (&fte->lock);
+          lock_release (&frame_clock_list_lock);
+          return false;
+        }
+      if (clock_list_iterator == &fte->clock_list_elem)
+        clock_list_next ();
+      list_remove (&fte->clock_list_elem);
+      fte->on_clock = false;
+      taken = true;
+    }
+  lock_release (&frame_clock_list_lock);
+  return taken;
+}
+
+/**
+ * @brief Whether evicting a resident frame needs no write
+ * @note an anonymous page is clean once a swap slot holds a copy and it
+ * has not been written since; a file page once its dirty bit is clear
+ */
+static bool
+fte_is_clean (struct fte *fte)
+{
+  if (pagedir_is_dirty (fte->owner->pagedir, fte->upage))
+    return false;
+  return fte->type == SPTE_FILE || fte->swap_copy != SWAP_NONE;
+}
+
+/**
+ * @brief Start writing dirty anonymous frames to swap
+ * @param ftes frames seen not accessed and dirty by the clock
+ * @param cnt number of frames in `ftes`
+ * @note The dirty bit is cleared before the copy is taken, so a write
+ * racing with the copy leaves the frame dirty and the copy unused.  The
+ * writes go through the asynchronous swap path; by the time the clock
+ * comes back the frames can be evicted without I/O.
+ * @note The frames come locked by the caller, which keeps them alive since
+ * fte_destroy waits for the lock, and are unlocked here.  The clock lock
+ * must not be held, so that faults and pins are not stuck behind the I/O.
+ */
+static void
+clock_clean (struct fte **ftes, size_t cnt)
+{
+  void *kpages[SWAP_CLUSTER];
+  swap_id_t swap_ids[SWAP_CLUSTER];
+  size_t clean_cnt = 0;
+
+  ASSERT (!lock_held_by_current_thread (&frame_clock_list_lock));
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      struct fte *fte = ftes[i];
+      ASSERT (lock_held_by_current_thread (&fte->lock));
+      if (fte->type != SPTE_FRAME || fte_is_clean (fte)
+          || page_is_zero (fte->kpage))
+        {
+          lock_release (&fte->lock);
+          continue;
+        }
+      pagedir_set_dirty (fte->owner->pagedir, fte->upage, false);
+      if (fte->swap_copy != SWAP_NONE)
+        {
+          // written since the last copy, which is stale now
+          swap_free (fte->swap_copy);
+          fte->swap_copy = SWAP_NONE;
+        }
+      ftes[clean_cnt] = fte;
+      kpages[clean_cnt++] = fte->kpage;
+    }
+
+  swap_write_multiple (kpages, clean_cnt, swap_ids);
+
+  for (size_t i = 0; i < clean_cnt; i++)
+    {
+      ftes[i]->swap_copy = swap_ids[i];
+      lock_release (&ftes[i]->lock);
+    }
+}
+
 /**
  * @brief Helper function for evicting a frame
+ * @note Enhanced second chance: the first sweep looks for a frame that is
+ * neither accessed nor dirty and changes nothing.  Later sweeps take any
+ * frame that is not accessed, clearing accessed bits on the way as the
+ * plain clock does.  Dirty anonymous frames passed over by the first
+ * sweep are written back asynchronously to become clean victims later.
+ * @return the victim, taken off the clock list with its lock held, or NULL
+ * if CLOCK_SWEEPS sweeps found every frame pinned, locked or in use
  * @note This function gaurentees thread safety
  */
 static struct fte *
@@ -65,73 +205,126 @@ clock_find_target_to_evict (void)
 {
   lock_acquire (&frame_clock_list_lock);
 
-  struct fte *evict_target;
+  struct fte *evict_target = NULL;
+  struct fte *dirty[SWAP_CLUSTER];
+  size_t dirty_cnt = 0;
+  struct pagedir_batch batch;
+  pagedir_batch_init (&batch);
+  size_t clock_cnt = list_size (&clock_list);
   bool found = false;
-  while (!found)
-    {
-      evict_target
-          = list_entry (clock_list_iterator, struct fte, clock_list_elem);
-      if (lock_try_acquire (&evict_target->lock))
-        {
-          if (pagedir_is_accessed (evict_target->owner->pagedir,
-                                   evict_target->upage))
-            /* if accessed, set accessed to false and move to next */
-            {
-              pagedir_set_accessed (evict_target->owner->pagedir,
-                                    evict_target->upage, false);
-              clock_list_next ();
-            }
-          else
-            found = true;
-          lock_release (&evict_target->lock);
-        }
-      else
-        {
+  for (int sweep = 0; sweep < CLOCK_SWEEPS && !found; sweep++)
+    for (size_t i = 0; i < clock_cnt && !found; i++)
+      {
+        evict_target
+            = list_entry (clock_list_iterator, struct fte, clock_list_elem);
+        // dirty frames set aside for cleaning stay locked by this thread
+        bool held = lock_held_by_current_thread (&evict_target->lock);
+        if (held || lock_try_acquire (&evict_target->lock))
+          {
+            bool keep = held;
+            union entry_t *pd = evict_target->owner->pagedir;
+            if (evict_target->pinned > 0)
+              ;
+            else if (pagedir_is_accessed (pd, evict_target->upage))
+              {
+                /* if accessed, set accessed to false and move to next */
+                if (sweep > 0)
+                  pagedir_clear_accessed (pd, evict_target->upage, &batch);
+              }
+            else if (sweep > 0 || fte_is_clean (evict_target))
+              found = true;
+            else if (!held && evict_target->type == SPTE_FRAME
+                     && dirty_cnt < SWAP_CLUSTER)
+              {
+                dirty[dirty_cnt++] = evict_target;
+                keep = true;
+              }
+            // the victim stays locked until it is evicted
+            if (!keep && !found)
+              lock_release (&evict_target->lock);
+          }
+        if (!found)
           clock_list_next ();
-        }
+      }
+
+  if (!found)
+    {
+      lock_release (&frame_clock_list_lock);
+      pagedir_batch_flush (&batch);
+      clock_clean (dirty, dirty_cnt);
+      return NULL;
     }
 
   // Now, cur_frame is the one that satisfies the condition:
-  // 1. not accessed
-  // 2. is a frame
+  // 1. not accessed, and clean if there was such a frame
+  // 2. is a frame, anonymous or mapped from a file
   // so we can evict it
   ASSERT (evict_target != NULL);
-  ASSERT (evict_target->type == SPTE_FRAME);
+  ASSERT (evict_target->type == SPTE_FRAME
+          || evict_target->type == SPTE_FILE);
   ASSERT (evict_target->kpage != NULL);
   ASSERT (is_user_vaddr (evict_target->upage));
 
   clock_list_next ();
   list_remove (&evict_target->clock_list_elem);
+  evict_target->on_clock = false;
+
+  // the victim is written by the caller anyway, and stays locked
+  for (size_t i = 0; i < dirty_cnt; i++)
+    if (dirty[i] == evict_target)
+      dirty[i] = dirty[--dirty_cnt];
 
   lock_release (&frame_clock_list_lock);
+  pagedir_batch_flush (&batch);
+  clock_clean (dirty, dirty_cnt);
   return evict_target;
 }
 
-static unsigned
-cur_frame_table_hash (const struct hash_elem *e, void *aux)
-{
-  const struct fte *fte = hash_entry (e, struct fte, cur_frame_table_elem);
-  return hash_bytes (&fte->upage, sizeof fte->upage);
-}
-
-static bool
-cur_frame_table_less (const struct hash_elem *a, const struct hash_elem *b,
-                      void *aux)
-{
-  const struct fte *fte_a = hash_entry (a, struct fte, cur_frame_table_elem);
-  const struct fte *fte_b = hash_entry (b, struct fte, cur_frame_table_elem);
-  return fte_a->upage < fte_b->upage;
-}
-
 /**
- * @brief initialize current frame table of a thread
- * @param frame_table
+ * @brief Find more frames to evict along with one found by
+ * clock_find_target_to_evict
+ * @param targets receives the frames found
+ * @param max the number of frames wanted
+ * @return the number of frames found, at most `max`
+ * @note Only a short stretch of the clock is scanned, so this may find fewer
+ * than `max` frames; unlike the first victim, no frame is waited for.
+ * @note The frames found are off the clock list with their locks held.
+ * @note This function gaurentees thread safety
  */
-void
-cur_frame_table_init (struct hash *frame_table)
+static size_t
+clock_find_more_targets_to_evict (struct fte **targets, size_t max)
 {
-  hash_init (frame_table, cur_frame_table_hash, cur_frame_table_less,
-             frame_table);
+  size_t cnt = 0;
+  struct pagedir_batch batch;
+  pagedir_batch_init (&batch);
+
+  lock_acquire (&frame_clock_list_lock);
+  for (size_t scanned = 0;
+       cnt < max && scanned < 2 * SWAP_CLUSTER && !list_empty (&clock_list);
+       scanned++)
+    {
+      struct fte *fte
+          = list_entry (clock_list_iterator, struct fte, clock_list_elem);
+      if (lock_try_acquire (&fte->lock))
+        {
+          bool accessed = pagedir_is_accessed (fte->owner->pagedir, fte->upage);
+          if (accessed)
+            pagedir_clear_accessed (fte->owner->pagedir, fte->upage, &batch);
+          if (!accessed && fte->pinned == 0)
+            {
+              clock_list_next ();
+              list_remove (&fte->clock_list_elem);
+              fte->on_clock = false;
+              targets[cnt++] = fte;
+              continue;
+            }
+          lock_release (&fte->lock);
+        }
+      clock_list_next ();
+    }
+  lock_release (&frame_clock_list_lock);
+  pagedir_batch_flush (&batch);
+  return cnt;
 }
 
 /**
@@ -141,14 +334,7 @@ cur_frame_table_init (struct hash *frame_table)
 struct fte *
 cur_frame_table_find (void *upage)
 {
-  struct thread *t = thread_current ();
-  struct hash *page_table = &t->frame_table;
-  struct fte fte;
-  fte.upage = upage;
-  struct hash_elem *e = hash_find (page_table, &fte.cur_frame_table_elem);
-  if (e != NULL)
-    return hash_entry (e, struct fte, cur_frame_table_elem);
-  return NULL;
+  return spt_find (thread_current ()->frame_table, upage);
 }
 
 void
@@ -156,15 +342,259 @@ frame_init (void)
 {
   lock_init (&frame_clock_list_lock);
   list_init (&clock_list);
+  lock_init (&readahead_lock);
+  list_init (&readahead_list);
+  readahead_cnt = 0;
+  share_init ();
+
+  size_t user_cnt = palloc_user_page_cnt ();
+  pageout_low = user_cnt / 32 > 8 ? user_cnt / 32 : 8;
+  if (pageout_low > user_cnt / 4)
+    pageout_low = user_cnt / 4;
+  pageout_high = 2 * pageout_low;
+  lock_init (&pageout_lock);
+  cond_init (&pageout_cond);
+  pageout_idle = true;
+  if (pageout_low > 0)
+    pageout_started
+        = thread_create ("pageout", PRI_DEFAULT, pageout_thread, NULL)
+          != TID_ERROR;
+}
+
+/**
+ * @brief whether a page holds only zero bytes
+ * @param kpage the page
+ */
+static bool
+page_is_zero (const void *kpage)
+{
+  const uint32_t *word = kpage;
+  for (size_t i = 0; i < PGSIZE / sizeof *word; i++)
+    if (word[i] != 0)
+      return false;
+  return true;
 }
 
 /**
- * @brief Automatically evict a frame from the memory
+ * @brief evict a resident page mapped from a file
+ * @param fte the frame table entry, locked
+ * @return false if the page is dirty and cannot be written back now, in
+ * which case it stays mapped
+ * @note a clean page is simply dropped, since the file holds its data; a
+ * dirty page is written back first.  The file system lock is only tried,
+ * because its holder may be waiting for this page.
+ */
+static bool
+fte_evict_file (struct fte *fte)
+{
+  union entry_t *pd = fte->owner->pagedir;
+  bool held = has_acquired_filesys ();
+  bool locked = held || try_acquire_filesys ();
+
+  if (!locked && pagedir_is_dirty (pd, fte->upage))
+    return false;
+
+  // no more writes from the owner after this
+  pagedir_clear_page (pd, fte->upage);
+  if (pagedir_is_dirty (pd, fte->upage))
+    {
+      if (!locked)
+        {
+          // dirtied just before the unmap, keep it
+          pagedir_set_page (pd, fte->upage, fte->kpage, fte->writable);
+          pagedir_set_dirty (pd, fte->upage, true);
+          return false;
+        }
+      file_write_at (fte->mmap_entry->file, fte->kpage, fte->size,
+                     fte->file_offset);
+      pagedir_set_dirty (pd, fte->upage, false);
+    }
+  if (locked && !held)
+    release_filesys ();
+
+  palloc_free_page (fte->kpage);
+  fte->kpage = NULL;
+  return true;
+}
+
+/**
+ * @brief wake the page-out thread if free user frames run low
+ * @note called by the page allocator after each user page allocation
  */
 void
+frame_check_free (void)
+{
+  if (!pageout_started || palloc_user_free_cnt () >= pageout_low)
+    return;
+
+  lock_acquire (&pageout_lock);
+  if (pageout_idle)
+    {
+      pageout_idle = false;
+      cond_signal (&pageout_cond, &pageout_lock);
+    }
+  lock_release (&pageout_lock);
+}
+
+/**
+ * @brief whether any frame could be evicted
+ */
+static bool
+frame_has_victims (void)
+{
+  lock_acquire (&frame_clock_list_lock);
+  bool has_victims = !list_empty (&clock_list);
+  lock_release (&frame_clock_list_lock);
+  return has_victims;
+}
+
+/**
+ * @brief page-out thread: refills the free user frames in the background
+ * @note each frame_evict() writes a whole cluster of victims with one
+ * transfer, so the swap writes are batched as well
+ */
+static void
+pageout_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      lock_acquire (&pageout_lock);
+      while (pageout_idle)
+        cond_wait (&pageout_cond, &pageout_lock);
+      lock_release (&pageout_lock);
+
+      while (palloc_user_free_cnt () < pageout_high && frame_has_victims ()
+             && frame_evict ())
+        continue;
+
+      lock_acquire (&pageout_lock);
+      pageout_idle = true;
+      lock_release (&pageout_lock);
+    }
+}
+
+/**
+ * @brief whether `a` should get a lower swap slot than `b`
+ */
+static bool
+fte_swap_order_less (const struct fte *a, const struct fte *b)
+{
+  if (a->owner != b->owner)
+    return a->owner < b->owner;
+  return a->upage < b->upage;
+}
+
+/**
+ * @brief Turn an unmapped anonymous frame into a swapped page without I/O
+ * @param fte the frame, already unmapped from its owner
+ * @return true if the swap copy of the page was still valid and was kept
+ * @note a copy made stale by later writes is released
+ */
+static bool
+fte_evict_clean (struct fte *fte)
+{
+  if (fte->swap_copy == SWAP_NONE)
+    return false;
+  if (pagedir_is_dirty (fte->owner->pagedir, fte->upage))
+    {
+      swap_free (fte->swap_copy);
+      fte->swap_copy = SWAP_NONE;
+      return false;
+    }
+  palloc_free_page (fte->kpage);
+  fte->swap_id = fte->swap_copy;
+  fte->swap_copy = SWAP_NONE;
+  fte->type = SPTE_SWAP;
+  return true;
+}
+
+/**
+ * @brief Automatically evict frames from the memory
+ * @note Frees an unused read-ahead frame instead, if there is one.
+ * @note Otherwise evicts up to SWAP_CLUSTER frames at once and writes them to
+ * consecutive swap slots in one transfer, ordered by owner and address so
+ * that virtually adjacent pages can be read back together.  All-zero pages
+ * are dropped without any I/O, and pages mapped from files are written back
+ * only if dirty and then dropped.
+ * @return false if no frame could be evicted now, after yielding the CPU so
+ * that the holders of pinned and locked frames can release them
+ */
+bool
 frame_evict (void)
 {
-  fte_evict (clock_find_target_to_evict ());
+  struct fte *targets[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  swap_id_t swap_ids[SWAP_CLUSTER];
+  size_t cnt;
+
+  // unused read-ahead pages are still in swap, drop them first
+  if (readahead_reclaim ())
+    return true;
+  // executable text nobody used recently is still in the file
+  if (share_reclaim ())
+    return true;
+
+  targets[0] = clock_find_target_to_evict ();
+  if (targets[0] == NULL)
+    {
+      thread_yield ();
+      return false;
+    }
+  cnt = 1 + clock_find_more_targets_to_evict (targets + 1, SWAP_CLUSTER - 1);
+
+  // insertion sort, the cluster is tiny
+  for (size_t i = 1; i < cnt; i++)
+    for (size_t j = i; j > 0 && fte_swap_order_less (targets[j], targets[j - 1]);
+         j--)
+      {
+        struct fte *tmp = targets[j];
+        targets[j] = targets[j - 1];
+        targets[j - 1] = tmp;
+      }
+
+  size_t swap_cnt = 0;
+  for (size_t i = 0; i < cnt; i++)
+    {
+      struct fte *fte = targets[i];
+      if (fte->type == SPTE_FILE)
+        {
+          // file-backed pages never go to swap
+          if (!fte_evict_file (fte))
+            clock_list_push_back (&fte->clock_list_elem);
+          lock_release (&fte->lock);
+          continue;
+        }
+      ASSERT (fte->type == SPTE_FRAME);
+      // remove the virtual map from the owner
+      pagedir_clear_page (fte->owner->pagedir, fte->upage);
+      if (fte_evict_clean (fte))
+        {
+          lock_release (&fte->lock);
+          continue;
+        }
+      if (page_is_zero (fte->kpage))
+        {
+          // nothing to save, refilled with zeros on fault
+          palloc_free_page (fte->kpage);
+          fte->type = SPTE_ZERO;
+          lock_release (&fte->lock);
+          continue;
+        }
+      targets[swap_cnt] = fte;
+      kpages[swap_cnt++] = fte->kpage;
+    }
+
+  swap_write_multiple (kpages, swap_cnt, swap_ids);
+
+  for (size_t i = 0; i < swap_cnt; i++)
+    {
+      struct fte *fte = targets[i];
+      fte->swap_id = swap_ids[i];
+      fte->type = SPTE_SWAP;
+      palloc_free_page (kpages[i]);
+      lock_release (&fte->lock);
+    }
+  return true;
 }
 
 /**
@@ -188,6 +618,10 @@ fte_create (void *upage, bool writable)
                                       | PAL_ZERO); // eviction may happen here
   fte->mmap_entry = NULL;
   fte->type = SPTE_FRAME;
+  fte->ra_kpage = NULL;
+  fte->swap_copy = SWAP_NONE;
+  fte->on_clock = false;
+  fte->pinned = 0;
 
   if (install_page (fte->upage, fte->kpage, fte->writable) == false)
     {
@@ -199,9 +633,7 @@ fte_create (void *upage, bool writable)
   lock_init (&fte->lock);
   lock_acquire (&fte->lock);
 
-  hash_insert (&fte->owner->frame_table, &fte->cur_frame_table_elem);
-
-  ASSERT (cur_frame_table_find (upage));
+  spt_insert (fte->owner->frame_table, fte);
 
   // initialize cur_frame at the first run
   clock_list_push_back (&fte->clock_list_elem);
@@ -215,13 +647,14 @@ fte_create (void *upage, bool writable)
  * @brief attach a fte to file
  * @param file the file to attach
  * @param file_offset the offset of the file
+ * @param size the number of bytes read from the file, the rest is zero
  * @param upage the user page
  * @param writable writable or not
  * @return fte if success, NULL if failed
  */
 struct fte *
-fte_attach_to_file (struct file *file, uint32_t file_offset, void *upage,
-                    bool writable)
+fte_attach_to_file (struct file *file, uint32_t file_offset, uint32_t size,
+                    void *upage, bool writable)
 {
   struct fte *fte = malloc (sizeof (struct fte));
   ASSERT (fte != NULL);
@@ -235,18 +668,20 @@ fte_attach_to_file (struct file *file, uint32_t file_offset, void *upage,
   fte->owner = thread_current ();
   fte->type = SPTE_FILE;
   fte->kpage = NULL;
+  fte->ra_kpage = NULL;
+  fte->swap_copy = SWAP_NONE;
+  fte->on_clock = false;
+  fte->pinned = 0;
   fte->file_offset = file_offset;
   fte->mmap_entry = mmap_entry;
-  fte->size = file_length (file) - file_offset;
-  if (fte->size > PGSIZE)
-    fte->size = PGSIZE;
+  fte->size = size;
   lock_init (&fte->lock);
 
   // add fte to mmap_entry's fte_list
   list_push_back (&mmap_entry->fte_list, &fte->fte_elem);
 
   // add fte into table
-  hash_insert (&fte->owner->frame_table, &fte->cur_frame_table_elem);
+  spt_insert (fte->owner->frame_table, fte);
 
   return fte;
 }
@@ -264,12 +699,13 @@ fte_detach_from_file (struct fte *fte)
   if (fte->kpage == NULL)
     {
       // allocate the frame
-      fte->kpage = palloc_get_page_force (PAL_USER);
+      fte->kpage = palloc_get_page_force (PAL_USER | PAL_ZERO);
       // load data
       file_read_at (fte->mmap_entry->file, fte->kpage, fte->size,
                     fte->file_offset);
       // install page
       ASSERT (install_page (fte->upage, fte->kpage, fte->writable));
+      clock_list_push_back (&fte->clock_list_elem);
     }
   else
     {
@@ -284,52 +720,388 @@ fte_detach_from_file (struct fte *fte)
     }
   fte->mmap_entry = NULL;
   fte->type = SPTE_FRAME;
-  clock_list_push_back (&fte->clock_list_elem);
 
   lock_release (&fte->lock);
 }
 
 /**
- * @brief evict a fte, copy from memory to swap
- * @param fte the frame table entry to evict
+ * @brief drop the oldest unused read-ahead frame, if any
+ * @return true if a frame was freed
+ * @note The page stays in its swap slot, so nothing is written.
+ */
+static bool
+readahead_reclaim (void)
+{
+  void *kpage = NULL;
+
+  lock_acquire (&readahead_lock);
+  if (!list_empty (&readahead_list))
+    {
+      struct fte *fte = list_entry (list_pop_front (&readahead_list),
+                                    struct fte, ra_elem);
+      kpage = fte->ra_kpage;
+      fte->ra_kpage = NULL;
+      readahead_cnt--;
+    }
+  lock_release (&readahead_lock);
+
+  if (kpage == NULL)
+    return false;
+  palloc_free_page (kpage);
+  return true;
+}
+
+/**
+ * @brief take the read-ahead frame of a swapped-out fte
+ * @param fte the frame table entry
+ * @return the frame holding the page of `fte`, or NULL if it was not read
+ * ahead (or its frame was reclaimed)
+ */
+static void *
+readahead_take (struct fte *fte)
+{
+  lock_acquire (&readahead_lock);
+  void *kpage = fte->ra_kpage;
+  if (kpage != NULL)
+    {
+      list_remove (&fte->ra_elem);
+      fte->ra_kpage = NULL;
+      readahead_cnt--;
+    }
+  lock_release (&readahead_lock);
+  return kpage;
+}
+
+/**
+ * @brief keep a page read ahead for a swapped-out fte
+ * @param fte the frame table entry
+ * @param kpage the frame holding the page of `fte`
+ * @note Drops the oldest read-ahead pages beyond READAHEAD_LIMIT.
+ */
+static void
+readahead_add (struct fte *fte, void *kpage)
+{
+  lock_acquire (&readahead_lock);
+  fte->ra_kpage = kpage;
+  list_push_back (&readahead_list, &fte->ra_elem);
+  readahead_cnt++;
+  lock_release (&readahead_lock);
+
+  while (readahead_cnt > READAHEAD_LIMIT && readahead_reclaim ())
+    continue;
+}
+
+/**
+ * @brief adapt the read-ahead window of the current thread to its hits
+ * @param upage the page being swapped in
+ * @return true if the thread seems to scan downwards
+ */
+static bool
+readahead_adapt (void *upage)
+{
+  struct thread *t = thread_current ();
+  bool descending = t->ra_last_fault != NULL && upage < t->ra_last_fault;
+
+  if (t->ra_hits > 0)
+    t->ra_window = t->ra_window * 2 < READAHEAD_MAX ? t->ra_window * 2
+                                                    : READAHEAD_MAX;
+  else
+    t->ra_window = t->ra_window / 2 > READAHEAD_MIN ? t->ra_window / 2
+                                                    : READAHEAD_MIN;
+  t->ra_hits = 0;
+  t->ra_last_fault = upage;
+  return descending;
+}
+
+/**
+ * @brief swap in a fte and read ahead its virtual neighbours
+ * @param fte the swapped-out frame table entry, locked
+ * @param kpage the frame to read `fte` into
+ * @note The neighbours in the direction of the scan whose slots continue
+ * the slot of `fte` are read with the same transfer, up to the thread's
+ * read-ahead window.  They are kept in frames without being mapped: the
+ * first access takes a minor fault that maps the frame and counts as a
+ * hit.  Pages that are busy, already read ahead, or for which no frame is
+ * free without eviction end the run.
+ * @note The slot of `fte` is not freed, it is kept as the swap copy.
+ */
+static void
+fte_swap_in (struct fte *fte, void *kpage)
+{
+  struct fte *ftes[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  size_t cnt = 1;
+  bool descending = readahead_adapt (fte->upage);
+  int dir = descending ? -1 : 1;
+  unsigned window = thread_current ()->ra_window;
+
+  ftes[0] = fte;
+  kpages[0] = kpage;
+  while (cnt <= window)
+    {
+      if (descending && (uintptr_t)fte->upage < cnt * PGSIZE)
+        break;
+      struct fte *next
+          = cur_frame_table_find (fte->upage + dir * (int)(cnt * PGSIZE));
+      if (next == NULL || !lock_try_acquire (&next->lock))
+        break;
+      if (next->type != SPTE_SWAP || next->ra_kpage != NULL
+          || next->swap_id != fte->swap_id + dir * (int)cnt
+          || (kpages[cnt] = palloc_get_page (PAL_USER)) == NULL)
+        {
+          lock_release (&next->lock);
+          break;
+        }
+      ftes[cnt++] = next;
+    }
+
+  // order by slot for one transfer
+  if (descending)
+    for (size_t i = 0; i < cnt / 2; i++)
+      {
+        struct fte *tmp_fte = ftes[i];
+        void *tmp_kpage = kpages[i];
+        ftes[i] = ftes[cnt - 1 - i];
+        kpages[i] = kpages[cnt - 1 - i];
+        ftes[cnt - 1 - i] = tmp_fte;
+        kpages[cnt - 1 - i] = tmp_kpage;
+      }
+
+  swap_read_multiple (ftes[0]->swap_id, cnt, kpages);
+
+  for (size_t i = 0; i < cnt; i++)
+    if (ftes[i] != fte)
+      {
+        readahead_add (ftes[i], kpages[i]);
+        lock_release (&ftes[i]->lock);
+      }
+}
+
+/**
+ * @brief read the page of a file-backed fte
+ * @param fte the locked, not resident fte
+ * @param kpage a zeroed frame to read into
+ * @note a private writable page is anonymous memory from then on
+ */
+static void
+fte_read_file (struct fte *fte, void *kpage)
+{
+  ASSERT (fte->type == SPTE_FILE && fte->kpage == NULL);
+
+  if (fte->size > 0)
+    {
+      bool held = has_acquired_filesys ();
+      if (!held)
+        acquire_filesys ();
+      file_read_at (fte->mmap_entry->file, kpage, fte->size,
+                    fte->file_offset);
+      if (!held)
+        release_filesys ();
+    }
+  if (fte->writable && fte->mmap_entry->private)
+    {
+      list_remove (&fte->fte_elem);
+      fte->mmap_entry = NULL;
+      fte->type = SPTE_FRAME;
+    }
+}
+
+/**
+ * @brief map a file page of the current thread next to a faulting one
+ * @param fte the page to map
+ * @return false if it needed a frame and none was free without eviction
+ * @note Pages that are busy or already mapped are left alone.  Shared
+ * text is mapped only if another process has it in memory.
+ */
+bool
+fte_fault_around (struct fte *fte)
+{
+  ASSERT (fte->owner == thread_current ());
+
+  if (!lock_try_acquire (&fte->lock))
+    return true;
+
+  bool success = true;
+  void *kpage;
+  if (fte->type == SPTE_FILE && fte->kpage == NULL)
+    {
+      if (share_candidate (fte))
+        share_map_cached (fte);
+      else if ((kpage = palloc_get_page (PAL_USER | PAL_ZERO)) != NULL)
+        {
+          fte_read_file (fte, kpage);
+          fte->kpage = kpage;
+          ASSERT (install_page (fte->upage, fte->kpage, fte->writable));
+          clock_list_push_back (&fte->clock_list_elem);
+        }
+      else
+        success = false;
+    }
+
+  lock_release (&fte->lock);
+  return success;
+}
+
+/**
+ * @brief drop a resident page of a file mapping before it is evicted
+ * @param fte a page of the current thread
+ * @note Dirty data is written back first.  Shared text only loses the
+ * mapping of this process.  Busy and anonymous pages are left alone.
+ */
+void
+fte_release (struct fte *fte)
+{
+  ASSERT (fte->owner == thread_current ());
+
+  if (share_candidate (fte))
+    share_unmap (fte);
+  else if (fte->type == SPTE_FILE && clock_list_take (fte))
+    {
+      bool held = has_acquired_filesys ();
+      if (!held)
+        acquire_filesys ();
+      fte_evict_file (fte);
+      if (!held)
+        release_filesys ();
+      lock_release (&fte->lock);
+    }
+}
+
+/**
+ * @brief write a dirty page of a shared file mapping back to the file
+ * @param fte a page of the current thread
+ * @note The dirty bit is cleared before the write, so a store racing with
+ * it leaves the page dirty for the next write-back.
  */
 void
-fte_evict (struct fte *fte)
+fte_sync (struct fte *fte)
 {
-  ASSERT (is_user_vaddr (fte->upage));
-  ASSERT (fte->kpage != NULL);
-  ASSERT (fte->type != SPTE_SWAP);
+  ASSERT (fte->owner == thread_current ());
 
   lock_acquire (&fte->lock);
+  union entry_t *pd = fte->owner->pagedir;
+  if (fte->type == SPTE_FILE && fte->kpage != NULL
+      && !fte->mmap_entry->private && pagedir_is_dirty (pd, fte->upage))
+    {
+      pagedir_set_dirty (pd, fte->upage, false);
+      bool held = has_acquired_filesys ();
+      if (!held)
+        acquire_filesys ();
+      file_write_at (fte->mmap_entry->file, fte->kpage, fte->size,
+                     fte->file_offset);
+      if (!held)
+        release_filesys ();
+    }
+  lock_release (&fte->lock);
+}
 
-  if (fte->type == SPTE_FILE)
+/**
+ * @brief fault in the page at `upage` and pin its frame
+ * @return false if `upage` is not mapped, or is read-only while `write`
+ * @note A resident frame off the clock list is being evicted, so wait
+ * for the eviction to finish and fault it back in.
+ */
+static bool
+fte_pin (void *upage, bool write)
+{
+  for (;;)
     {
-      // write back if dirty
-      if (pagedir_is_dirty (fte->owner->pagedir, fte->upage))
+      struct fte *fte = cur_frame_table_find (upage);
+      bool pinned = false;
+      bool evicting = false;
+      if (fte != NULL)
         {
-          acquire_filesys ();
-          file_write_at (fte->mmap_entry->file, fte->upage, fte->size,
-                         fte->file_offset);
-          release_filesys ();
+          if (write && !fte->writable)
+            return false;
+          lock_acquire (&fte->lock);
+          if (share_candidate (fte))
+            pinned = share_pin (fte);
+          else if (fte->type == SPTE_FRAME
+                   || (fte->type == SPTE_FILE && fte->kpage != NULL))
+            {
+              lock_acquire (&frame_clock_list_lock);
+              if (fte->on_clock)
+                {
+                  fte->pinned++;
+                  pinned = true;
+                }
+              else
+                evicting = true;
+              lock_release (&frame_clock_list_lock);
+            }
+          lock_release (&fte->lock);
         }
+      if (pinned)
+        return true;
+      if (evicting)
+        thread_yield ();
+      else if (!user_stack_growth (upage, thread_current ()->esp))
+        return false;
     }
+}
 
-  // remove the virtual map from current thread
-  pagedir_clear_page (fte->owner->pagedir, fte->upage);
+/**
+ * @brief fault in and pin the frames backing a user buffer
+ * @param uaddr start of the buffer
+ * @param size size of the buffer in bytes
+ * @param write whether the kernel stores into the buffer
+ * @return false if a page of the buffer is not mapped, or is read-only
+ * while `write`; nothing is left pinned then
+ * @note A pinned frame stays resident until frame_unpin, so a system call
+ * can copy the buffer while holding the file system lock without faulting.
+ * The clock hand passes over pinned frames, so keep buffers short.
+ */
+bool
+frame_pin (const void *uaddr, size_t size, bool write)
+{
+  if (size == 0)
+    return true;
 
-  void *kpage = fte->kpage;
-  fte->swap_id = swap_write (kpage);
-  palloc_free_page (kpage);
+  void *first = pg_round_down (uaddr);
+  void *last = pg_round_down (uaddr + size - 1);
+  for (void *upage = first; upage <= last; upage += PGSIZE)
+    if (!fte_pin (upage, write))
+      {
+        if (upage > first)
+          frame_unpin (first, upage - first);
+        return false;
+      }
+  return true;
+}
 
-  if (fte->type == SPTE_FRAME)
-    fte->type = SPTE_SWAP;
+/**
+ * @brief unpin the frames pinned by frame_pin
+ * @param uaddr start of the buffer
+ * @param size size of the buffer in bytes
+ */
+void
+frame_unpin (const void *uaddr, size_t size)
+{
+  if (size == 0)
+    return;
 
-  lock_release (&fte->lock);
+  void *last = pg_round_down (uaddr + size - 1);
+  for (void *upage = pg_round_down (uaddr); upage <= last; upage += PGSIZE)
+    {
+      struct fte *fte = cur_frame_table_find (upage);
+      ASSERT (fte != NULL);
+      lock_acquire (&fte->lock);
+      if (share_candidate (fte))
+        share_unpin (fte);
+      else
+        {
+          ASSERT (fte->pinned > 0);
+          fte->pinned--;
+        }
+      lock_release (&fte->lock);
+    }
 }
 
 /**
  * @brief unevict a fte, copy from swap to memory
  * @param fte the frame table entry to unevict
+ * @note The type is only read under the lock, which an eviction holds
+ * until it is done, so a page found resident is left as it is.
  */
 void
 fte_unevict (struct fte *fte)
@@ -338,47 +1110,60 @@ fte_unevict (struct fte *fte)
 
   lock_acquire (&fte->lock);
 
-  // force allocate memory, eviction may happen here
-  void *new_kpage = palloc_get_page_force (PAL_USER);
+  if (share_candidate (fte))
+    {
+      // executable text, mapped from the shared cache
+      share_map (fte);
+      lock_release (&fte->lock);
+      return;
+    }
 
-  if (fte->type == SPTE_SWAP)
+  if (fte->type == SPTE_FRAME
+      || (fte->type == SPTE_FILE && fte->kpage != NULL))
     {
-      swap_id_t swap_id = fte->swap_id; // from which to restore
+      // the fault raced with an eviction that failed or was not finished
+      // when the owner checked, and the page is mapped now
+      lock_release (&fte->lock);
+      return;
+    }
 
-      // restore memory
-      swap_read (swap_id, new_kpage);
-      swap_free (swap_id);
+  void *new_kpage = NULL;
+  if (fte->type == SPTE_SWAP && (new_kpage = readahead_take (fte)) != NULL)
+    {
+      // read-ahead hit, the page is in memory already
+      thread_current ()->ra_hits++;
     }
+  else if (fte->type == SPTE_SWAP)
+    {
+      // force allocate memory, eviction may happen here
+      new_kpage = palloc_get_page_force (PAL_USER);
+      fte_swap_in (fte, new_kpage);
+    }
+  else if (fte->type == SPTE_ZERO)
+    // evicted while all zero
+    new_kpage = palloc_get_page_force (PAL_USER | PAL_ZERO);
   else if (fte->type == SPTE_FILE)
     {
-      // write back if dirty
-      if (pagedir_is_dirty (fte->owner->pagedir, fte->upage))
-        {
-          acquire_filesys ();
-          file_write_at (fte->mmap_entry->file, fte->upage, fte->size,
-                         fte->file_offset);
-          release_filesys ();
-        }
-      // load data
-      acquire_filesys ();
-      file_read_at (fte->mmap_entry->file, new_kpage, fte->size,
-                    fte->file_offset);
-      release_filesys ();
+      // dirty data was written back when the page was evicted
+      // force allocate memory, eviction may happen here
+      new_kpage = palloc_get_page_force (PAL_USER | PAL_ZERO);
+      fte_read_file (fte, new_kpage);
     }
   else
     {
       PANIC ("should not reach here");
     }
 
+  // the swap slot stays as a copy until the page is written
+  fte->swap_copy = fte->type == SPTE_SWAP ? fte->swap_id : SWAP_NONE;
+
   // install virtual map
   fte->kpage = new_kpage;
   ASSERT (install_page (fte->upage, fte->kpage, fte->writable));
 
-  if (fte->type == SPTE_SWAP)
-    {
-      fte->type = SPTE_FRAME;
-      clock_list_push_back (&fte->clock_list_elem);
-    }
+  if (fte->type == SPTE_SWAP || fte->type == SPTE_ZERO)
+    fte->type = SPTE_FRAME;
+  clock_list_push_back (&fte->clock_list_elem);
 
   lock_release (&fte->lock);
 }
@@ -390,23 +1175,35 @@ fte_unevict (struct fte *fte)
  * be freed in process_exit by pagedir_destroy (pd);
  * @note this may write to through file if dirty
  * so the file should not be closed
+ * @note an eviction in progress holds the lock, so it finishes first
  */
 void
 fte_destroy (struct fte *fte)
 {
   ASSERT (fte->owner == thread_current ());
 
+  lock_acquire (&fte->lock);
+
   // remove from thread's frame table
-  /// TODO : check if it is thread safe
-  hash_delete (&fte->owner->frame_table, &fte->cur_frame_table_elem);
+  spt_remove (fte->owner->frame_table, fte);
 
   // remove from clock list
   if (fte->type == SPTE_SWAP)
-    swap_free (fte->swap_id);
+    {
+      void *kpage = readahead_take (fte);
+      if (kpage != NULL)
+        palloc_free_page (kpage);
+      swap_free (fte->swap_id);
+    }
+  else if (share_candidate (fte))
+    share_unmap (fte);
   else if (fte->type == SPTE_FILE)
     {
-      // write back if dirty
-      if (pagedir_is_dirty (fte->owner->pagedir, fte->upage))
+      if (fte->kpage != NULL)
+        clock_list_remove (&fte->clock_list_elem);
+      // write back if dirty, only resident pages can be
+      if (fte->kpage != NULL
+          && pagedir_is_dirty (fte->owner->pagedir, fte->upage))
         {
           struct file *file = fte->mmap_entry->file;
           ASSERT (is_file (file));
@@ -421,11 +1218,38 @@ fte_destroy (struct fte *fte)
   else if (fte->type == SPTE_FRAME)
     {
       clock_list_remove (&fte->clock_list_elem);
+      if (fte->swap_copy != SWAP_NONE)
+        swap_free (fte->swap_copy);
     }
 
+  lock_release (&fte->lock);
   free (fte);
 }
 
+/**
+ * @brief create the mmap_entry of a file
+ * @param file the file to map
+ * @param mapid the mapping id
+ * @param private whether writes stay private to the process instead of
+ * reaching the file
+ * @return the mmap_entry, also set as `file->mmap_entry`
+ */
+struct mmap_entry *
+mmap_create (struct file *file, int mapid, bool private)
+{
+  ASSERT (file->mmap_entry == NULL);
+
+  struct mmap_entry *mmap_entry = malloc (sizeof (struct mmap_entry));
+  ASSERT (mmap_entry != NULL);
+  mmap_entry->mapid = mapid;
+  mmap_entry->file = file;
+  mmap_entry->private = private;
+  list_init (&mmap_entry->fte_list);
+  list_init (&mmap_entry->vma_list);
+  file->mmap_entry = mmap_entry;
+  return mmap_entry;
+}
+
 /**
  * @brief destroy a mmap_entry
  * @param mmap_entry to destroy
@@ -445,6 +1269,10 @@ mmap_destroy (struct mmap_entry *mmap_entry,
       ASSERT (fte->mmap_entry == mmap_entry);
       destroy_func (fte);
     }
+  // pages never touched have no fte, only their region
+  while (!list_empty (&mmap_entry->vma_list))
+    vma_destroy (
+        list_entry (list_front (&mmap_entry->vma_list), struct vma, elem));
 
   mmap_entry->file->mmap_entry = NULL;
   free (mmap_entry);
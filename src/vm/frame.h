@@ -14,6 +14,12 @@ enum frame_type
   SPTE_ZERO   // zero
 };
 
+/* Bounds of a thread's swap read-ahead window, in pages read
+   besides the faulting one.  The window doubles after a fault that
+   followed read-ahead hits and halves after one that did not. */
+#define READAHEAD_MIN 1
+#define READAHEAD_MAX (SWAP_CLUSTER - 1)
+
 extern struct lock frame_clock_list_lock;
 
 struct fte;
@@ -23,6 +29,8 @@ struct mmap_entry
   int mapid;
   struct file *file;
   struct list fte_list;
+  bool private; // writable pages become anonymous once loaded
+  struct list vma_list; // regions of the owner mapping the file
 };
 
 struct fte
@@ -43,11 +51,17 @@ struct fte
   enum frame_type type; // type of the supplemental page table entry
   bool writable;        // writable or not
 
-  struct hash_elem cur_frame_table_elem; // hash element for frame table
-
   struct list_elem clock_list_elem; // list element for clock algorithm
+  bool on_clock; // on the clock list, under frame_clock_list_lock
+  unsigned pinned; // pin count, a pinned frame is never evicted
   struct list_elem fte_elem;
 
+  void *ra_kpage;           // swapped page read ahead, not yet mapped
+  struct list_elem ra_elem; // list element for read-ahead pages
+
+  swap_id_t swap_copy; // resident page: slot with a copy, valid while clean
+  struct list_elem share_elem; // element in a shared page's reverse map
+
   struct lock lock; // lock for frame table entry
 };
 
@@ -55,26 +69,33 @@ struct fte *cur_frame_table_find (void *upage);
 
 /* ------------------- Current Frame Table Methods -------------------- */
 
-void cur_frame_table_init (struct hash *cur_frame_table);
 struct fte *cur_frame_table_find (void *upage);
 
 /* ------------------- Global Frame Table Methods -------------------- */
 
 void frame_init (void);  // initialize frame table
-void frame_evict (void); // automatically evict a frame
+bool frame_evict (void); // automatically evict a frame
+void frame_check_free (void); // wake the page-out thread if needed
 
 /* -------------------- Frame Table Entry Methods -------------------- */
 
 struct fte *fte_create (void *upage, bool writable);
-void fte_evict (struct fte *fte);
 void fte_unevict (struct fte *fte);
+bool fte_fault_around (struct fte *fte);
+void fte_release (struct fte *fte);
+void fte_sync (struct fte *fte);
 void fte_destroy (struct fte *fte);
+
+bool frame_pin (const void *uaddr, size_t size, bool write);
+void frame_unpin (const void *uaddr, size_t size);
 struct fte *fte_attach_to_file (struct file *file, uint32_t file_offset,
-                                void *upage, bool writable);
+                                uint32_t size, void *upage, bool writable);
 void fte_detach_from_file (struct fte *fte);
 
 typedef void (*mmap_elem_destroy_func) (struct fte *);
 
+struct mmap_entry *mmap_create (struct file *file, int mapid, bool private);
+
 void mmap_destroy (struct mmap_entry *mmap_entry,
                    mmap_elem_destroy_func destroy_func);
 
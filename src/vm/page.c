@@ -1,13 +1,113 @@
 #include "page.h"
 #include "frame.h"
 #include "swap.h"
+#include "vma.h"
 
 #include "filesys/off_t.h"
+#include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 
-#define STACK_MAX (1 << 23) // 8MB
+/* Supplemental page table.
+
+   Laid out like the x86 page tables: a directory indexed by
+   pd_no() of the user page points to tables of PGSIZE bytes
+   indexed by pt_no(), holding the frame table entries.  A lookup
+   is two array reads, and a table is allocated once for each
+   4 MB of address space in use.  Tables stay allocated until the
+   whole supplemental page table is destroyed. */
+
+/* Directory entries covering user virtual memory. */
+#define SPT_DIR_CNT (LOADER_PHYS_BASE >> PDSHIFT)
+#define SPT_TABLE_CNT (PGSIZE / sizeof (struct fte *))
+
+struct spt
+{
+  struct fte **tables[SPT_DIR_CNT]; // tables of entries, or NULL
+};
+
+/**
+ * @brief create an empty supplemental page table
+ * @return the table, or NULL if memory is short
+ */
+struct spt *
+spt_create (void)
+{
+  ASSERT (sizeof (struct spt) <= PGSIZE);
+  return palloc_get_page (PAL_ZERO);
+}
+
+/**
+ * @brief destroy a supplemental page table
+ * @param spt the table, may be NULL
+ * @param action called on each entry still present, in address order; it
+ * may remove the entry
+ */
+void
+spt_destroy (struct spt *spt, spt_action_func *action)
+{
+  if (spt == NULL)
+    return;
+
+  for (size_t pde = 0; pde < SPT_DIR_CNT; pde++)
+    {
+      struct fte **table = spt->tables[pde];
+      if (table == NULL)
+        continue;
+      for (size_t pte = 0; pte < SPT_TABLE_CNT; pte++)
+        if (table[pte] != NULL)
+          action (table[pte]);
+      palloc_free_page (table);
+    }
+  palloc_free_page (spt);
+}
+
+/**
+ * @brief find the entry of a user page
+ * @return the entry, or NULL if there is none
+ */
+struct fte *
+spt_find (const struct spt *spt, const void *upage)
+{
+  if (spt == NULL || !is_user_vaddr (upage))
+    return NULL;
+
+  struct fte **table = spt->tables[pd_no (upage)];
+  return table != NULL ? table[pt_no (upage)] : NULL;
+}
+
+/**
+ * @brief add an entry for `fte->upage`, which must have none yet
+ */
+void
+spt_insert (struct spt *spt, struct fte *fte)
+{
+  ASSERT (pg_ofs (fte->upage) == 0);
+  ASSERT (is_user_vaddr (fte->upage));
+
+  struct fte ***table = &spt->tables[pd_no (fte->upage)];
+  if (*table == NULL)
+    {
+      *table = palloc_get_page (PAL_ZERO);
+      if (*table == NULL)
+        PANIC ("out of memory for the supplemental page table");
+    }
+  ASSERT ((*table)[pt_no (fte->upage)] == NULL);
+  (*table)[pt_no (fte->upage)] = fte;
+}
+
+/**
+ * @brief remove the entry of `fte->upage`
+ */
+void
+spt_remove (struct spt *spt, struct fte *fte)
+{
+  struct fte **table = spt->tables[pd_no (fte->upage)];
+  ASSERT (table != NULL && table[pt_no (fte->upage)] == fte);
+  table[pt_no (fte->upage)] = NULL;
+}
 
 bool
 user_stack_growth (void *fault_addr, void *esp)
@@ -18,7 +118,14 @@ user_stack_growth (void *fault_addr, void *esp)
 
   struct fte *fte = cur_frame_table_find (upage);
 
-  if (fte == NULL)
+  struct vma *vma;
+  if (fte == NULL && (vma = vma_find (upage)) != NULL)
+    {
+      // first touch of a page mapped from a file
+      fte_unevict (vma_attach_page (vma, upage));
+      vma_fault_around (vma, upage);
+    }
+  else if (fte == NULL)
     {
       // try stack growth
       if (fault_addr >= esp - 32 && upage >= PHYS_BASE - STACK_MAX)
@@ -36,10 +143,17 @@ user_stack_growth (void *fault_addr, void *esp)
       switch (fte->type)
         {
         case SPTE_FRAME:
-          PANIC (" frame should not exist, otherwise won't raise page fault.");
+          // unmapped by an eviction that has not retyped it yet, so wait
+          // for it under the lock and fault the page back in
+          fte_unevict (fte);
           break;
-        case SPTE_SWAP:
         case SPTE_FILE:
+          fte_unevict (fte);
+          if ((vma = vma_find (upage)) != NULL)
+            vma_fault_around (vma, upage);
+          break;
+        case SPTE_SWAP:
+        case SPTE_ZERO:
           fte_unevict (fte);
           break;
         default:
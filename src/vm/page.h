@@ -4,6 +4,19 @@
 #include "threads/palloc.h"
 #include <hash.h>
 
+#define STACK_MAX (1 << 23) // 8MB, reserved for the stack
+
+struct fte;
+struct spt;
+
+typedef void spt_action_func (struct fte *);
+
+struct spt *spt_create (void);
+void spt_destroy (struct spt *, spt_action_func *);
+struct fte *spt_find (const struct spt *, const void *upage);
+void spt_insert (struct spt *, struct fte *);
+void spt_remove (struct spt *, struct fte *);
+
 bool user_stack_growth (void *fault_addr, void *esp);
 
-#endif /* vm/supplemental_page_table.h */
\ No newline at end of file
+#endif /* vm/supplemental_page_table.h */
@@ -0,0 +1,317 @@
+#include "share.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include <hash.h>
+#include <list.h>
+
+/* Shared executable text.
+
+   Read-only pages of executables are cached by inode, offset and
+   the number of bytes read from the file, the rest of the page
+   being zeros, and every process running the same program maps the same frame.
+   A cached page lists the frame table entries mapping it, which is
+   both its reference count and the reverse map used to unmap it
+   from every process when it is reclaimed.  A page is dropped once
+   nobody maps it; its contents are always in the executable, which
+   cannot be written while it runs, so nothing is ever written back.
+
+   Shared pages are not on the clock list.  frame_evict reclaims
+   them first, with a second chance given by the accessed bits of
+   all their mappings. */
+
+/* Most cached pages looked at by one share_reclaim call. */
+#define SHARE_SCAN_MAX 16
+
+/* A cached page of an executable. */
+struct share_page
+{
+  struct hash_elem hash_elem; /* Element in share_map. */
+  struct list_elem lru_elem;  /* Element in share_lru. */
+  struct inode *inode;        /* Executable. */
+  uint32_t offset;            /* Offset of the page in the executable. */
+  uint32_t size;              /* Bytes read from there, then zeros. */
+  void *kpage;                /* Frame holding the page. */
+  struct list mappers;        /* Mapping ftes, by share_elem. */
+};
+
+static struct hash share_map_table; /* Pages by inode, offset, size. */
+static struct list share_lru;       /* Pages, in reclaim order. */
+static struct lock share_lock;      /* Protects the above, the pages and
+                                       kpage of the mapping ftes. */
+
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct share_page *page
+      = hash_entry (e, struct share_page, hash_elem);
+  return hash_bytes (&page->inode, sizeof page->inode)
+         ^ hash_int (page->offset) ^ hash_int (page->size);
+}
+
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share_page *a = hash_entry (a_, struct share_page, hash_elem);
+  const struct share_page *b = hash_entry (b_, struct share_page, hash_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return a->size < b->size;
+}
+
+/**
+ * @brief Initializes the shared page cache.
+ */
+void
+share_init (void)
+{
+  hash_init (&share_map_table, share_hash, share_less, NULL);
+  list_init (&share_lru);
+  lock_init (&share_lock);
+}
+
+/**
+ * @brief Whether the page of `fte` is shared between processes
+ * @note true for the read-only pages of an executable
+ */
+bool
+share_candidate (const struct fte *fte)
+{
+  return fte->type == SPTE_FILE && !fte->writable
+         && fte->mmap_entry->private;
+}
+
+/**
+ * @brief Finds the cached page `fte` maps
+ * @note share_lock must be held
+ */
+static struct share_page *
+share_lookup (const struct fte *fte)
+{
+  struct share_page key;
+  key.inode = file_get_inode (fte->mmap_entry->file);
+  key.offset = fte->file_offset;
+  key.size = fte->size;
+  struct hash_elem *e = hash_find (&share_map_table, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct share_page, hash_elem) : NULL;
+}
+
+/**
+ * @brief Drops a cached page and frees its frame
+ * @note share_lock must be held and nobody may map the page
+ */
+static void
+share_free (struct share_page *page)
+{
+  ASSERT (list_empty (&page->mappers));
+  hash_delete (&share_map_table, &page->hash_elem);
+  list_remove (&page->lru_elem);
+  palloc_free_page (page->kpage);
+  free (page);
+}
+
+/**
+ * @brief Maps `page` at `fte->upage` for the current process
+ * @note share_lock must be held
+ */
+static void
+share_add_mapper (struct share_page *page, struct fte *fte)
+{
+  fte->kpage = page->kpage;
+  list_push_back (&page->mappers, &fte->share_elem);
+  ASSERT (install_page (fte->upage, fte->kpage, false));
+}
+
+/**
+ * @brief Maps the cached page of `fte` for the current process
+ * @param fte a locked, not mapped share_candidate of the current thread
+ * @note The page is read from the executable if nobody has it yet.
+ */
+void
+share_map (struct fte *fte)
+{
+  ASSERT (share_candidate (fte));
+  ASSERT (fte->owner == thread_current ());
+
+  lock_acquire (&share_lock);
+  struct share_page *page = share_lookup (fte);
+  if (page == NULL)
+    {
+      // reading may evict, which reclaims shared pages, so unlock
+      lock_release (&share_lock);
+      void *kpage = palloc_get_page_force (PAL_USER | PAL_ZERO);
+      if (fte->size > 0)
+        {
+          bool held = has_acquired_filesys ();
+          if (!held)
+            acquire_filesys ();
+          file_read_at (fte->mmap_entry->file, kpage, fte->size,
+                        fte->file_offset);
+          if (!held)
+            release_filesys ();
+        }
+
+      lock_acquire (&share_lock);
+      page = share_lookup (fte);
+      if (page != NULL)
+        // read by another process meanwhile
+        palloc_free_page (kpage);
+      else
+        {
+          page = malloc (sizeof *page);
+          ASSERT (page != NULL);
+          page->inode = file_get_inode (fte->mmap_entry->file);
+          page->offset = fte->file_offset;
+          page->size = fte->size;
+          page->kpage = kpage;
+          list_init (&page->mappers);
+          hash_insert (&share_map_table, &page->hash_elem);
+          list_push_back (&share_lru, &page->lru_elem);
+        }
+    }
+
+  share_add_mapper (page, fte);
+  lock_release (&share_lock);
+}
+
+/**
+ * @brief Maps the cached page of `fte` if some process has it in memory
+ * @param fte a locked, not mapped share_candidate of the current thread
+ * @return true if the page was mapped
+ */
+bool
+share_map_cached (struct fte *fte)
+{
+  ASSERT (share_candidate (fte));
+  ASSERT (fte->owner == thread_current ());
+
+  lock_acquire (&share_lock);
+  struct share_page *page = share_lookup (fte);
+  if (page != NULL)
+    share_add_mapper (page, fte);
+  lock_release (&share_lock);
+  return page != NULL;
+}
+
+/**
+ * @brief Unmaps the cached page of `fte`, if mapped
+ * @note The frame is freed with its last mapping.  The page table entry
+ * is cleared, so pagedir_destroy does not free the frame.
+ */
+void
+share_unmap (struct fte *fte)
+{
+  ASSERT (share_candidate (fte));
+
+  lock_acquire (&share_lock);
+  if (fte->kpage != NULL)
+    {
+      struct share_page *page = share_lookup (fte);
+      ASSERT (page != NULL && page->kpage == fte->kpage);
+      list_remove (&fte->share_elem);
+      pagedir_clear_page (fte->owner->pagedir, fte->upage);
+      fte->kpage = NULL;
+      if (list_empty (&page->mappers))
+        share_free (page);
+    }
+  lock_release (&share_lock);
+}
+
+/**
+ * @brief Pins the cached page of `fte` if it is mapped
+ * @return false if `fte` has to be faulted in first
+ */
+bool
+share_pin (struct fte *fte)
+{
+  ASSERT (share_candidate (fte));
+
+  lock_acquire (&share_lock);
+  bool mapped = fte->kpage != NULL;
+  if (mapped)
+    fte->pinned++;
+  lock_release (&share_lock);
+  return mapped;
+}
+
+/**
+ * @brief Unpins the cached page of `fte`
+ */
+void
+share_unpin (struct fte *fte)
+{
+  ASSERT (share_candidate (fte));
+
+  lock_acquire (&share_lock);
+  ASSERT (fte->pinned > 0);
+  fte->pinned--;
+  lock_release (&share_lock);
+}
+
+/**
+ * @brief Whether any process accessed `page` since the last call
+ * @note clears the accessed bits it finds; a pinned mapping counts as
+ * accessed, so the page is kept
+ */
+static bool
+share_accessed (struct share_page *page)
+{
+  bool accessed = false;
+  for (struct list_elem *e = list_begin (&page->mappers);
+       e != list_end (&page->mappers); e = list_next (e))
+    {
+      struct fte *fte = list_entry (e, struct fte, share_elem);
+      union entry_t *pd = fte->owner->pagedir;
+      if (fte->pinned > 0)
+        accessed = true;
+      else if (pagedir_is_accessed (pd, fte->upage))
+        {
+          pagedir_set_accessed (pd, fte->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/**
+ * @brief Frees the frame of a shared page no process used recently
+ * @return true if a frame was freed
+ * @note The page is unmapped from every process through its reverse map;
+ * each of them faults it back in on the next access.
+ */
+bool
+share_reclaim (void)
+{
+  bool freed = false;
+
+  lock_acquire (&share_lock);
+  for (size_t i = 0; i < SHARE_SCAN_MAX && !list_empty (&share_lru); i++)
+    {
+      struct share_page *page = list_entry (list_pop_front (&share_lru),
+                                            struct share_page, lru_elem);
+      list_push_back (&share_lru, &page->lru_elem);
+      if (share_accessed (page))
+        continue;
+
+      while (!list_empty (&page->mappers))
+        {
+          struct fte *fte = list_entry (list_pop_front (&page->mappers),
+                                        struct fte, share_elem);
+          pagedir_clear_page (fte->owner->pagedir, fte->upage);
+          fte->kpage = NULL;
+        }
+      share_free (page);
+      freed = true;
+      break;
+    }
+  lock_release (&share_lock);
+  return freed;
+}
@@ -0,0 +1,16 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include "frame.h"
+#include <stdbool.h>
+
+void share_init (void);
+bool share_candidate (const struct fte *);
+void share_map (struct fte *);
+bool share_map_cached (struct fte *);
+void share_unmap (struct fte *);
+bool share_pin (struct fte *);
+void share_unpin (struct fte *);
+bool share_reclaim (void);
+
+#endif /* vm/share.h */
@@ -1,7 +1,13 @@
 #include "swap.h"
+#include "zswap.h"
 #include "bitmap.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include <list.h>
+#include <stdint.h>
+#include <string.h>
 
 static struct block *swap_device;
 static struct bitmap *swap_used_map;
@@ -9,6 +15,46 @@ static struct lock swap_lock;
 
 #define BLOCK_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Most pages being written to swap asynchronously at once; further
+   swap-outs wait for the disk. */
+#define SWAP_OUT_MAX 32
+
+/* A cluster of pages being written to consecutive swap slots
+   asynchronously. */
+struct swap_out
+{
+  struct list_elem elem;      /* Element in swap_out_list. */
+  swap_id_t first;            /* First slot being written. */
+  size_t cnt;                 /* Number of slots being written. */
+  bool freed[SWAP_CLUSTER];   /* swap_free() called before completion. */
+  void *pages;                /* Copy of the CNT pages being written. */
+  struct block_request req;   /* The write request. */
+};
+
+/* In-flight swap-outs, protected by swap_lock. */
+static struct list swap_out_list;
+static size_t swap_out_cnt; /* Pages in flight. */
+
+/* References to each slot, protected by swap_lock.  Identical pages
+   share one slot, which is released with its last reference. */
+static uint16_t *swap_refs;
+
+/* Number of entries in the same-page index. */
+#define SHARE_SIZE 256
+
+/* A recently swapped page, indexed by checksum so that identical pages
+   swapped later can share its slot.  Entries are hints: a candidate is
+   always compared byte by byte before it is shared. */
+struct share_entry
+{
+  bool valid;     /* Entry in use? */
+  uint32_t sum;   /* Checksum of the page. */
+  swap_id_t slot; /* Slot the page was stored in. */
+};
+static struct share_entry share_table[SHARE_SIZE]; /* Under swap_lock. */
+
+static void swap_writeback (swap_id_t, void *page);
+
 /**
  * @brief initalize the swap
  */
@@ -17,59 +63,381 @@ swap_init (void)
 {
   swap_device = block_get_role (BLOCK_SWAP);
   swap_used_map = bitmap_create (block_size (swap_device) / BLOCK_PER_PAGE);
+  if (swap_used_map == NULL)
+    PANIC ("swap_init: out of memory");
+  swap_refs = calloc (bitmap_size (swap_used_map), sizeof *swap_refs);
+  if (swap_refs == NULL)
+    PANIC ("swap_init: out of memory");
   lock_init (&swap_lock);
+  list_init (&swap_out_list);
+  swap_out_cnt = 0;
+  zswap_init (swap_writeback);
 }
 
 /**
- * @brief alloc a block in swap table
- * @return the swap index (block sector / 8)
+ * @brief alloc consecutive slots in swap table
+ * @param cnt the number of slots wanted
+ * @param first set to the first slot allocated
+ * @return the number of slots allocated, between 1 and `cnt`; fewer than
+ * `cnt` if no run of `cnt` free slots exists
  */
-swap_id_t
-swap_alloc ()
+static size_t
+swap_alloc_run (size_t cnt, swap_id_t *first)
 {
   lock_acquire (&swap_lock);
-  swap_id_t swap_idx = bitmap_scan_and_flip (swap_used_map, 0, 1, false);
+  while ((*first = bitmap_scan_and_flip (swap_used_map, 0, cnt, false))
+             == BITMAP_ERROR
+         && cnt > 1)
+    cnt /= 2;
+  if (*first != BITMAP_ERROR)
+    for (size_t i = 0; i < cnt; i++)
+      swap_refs[*first + i] = 1;
   lock_release (&swap_lock);
-  if (swap_idx == BITMAP_ERROR)
+  if (*first == BITMAP_ERROR)
     PANIC ("Swap if full");
-  return swap_idx;
+  return cnt;
+}
+
+/**
+ * @brief find the in-flight swap-out of a slot
+ * @param swap_idx
+ * @return the swap-out, or NULL if the slot is not being written
+ * @note swap_lock must be held
+ */
+static struct swap_out *
+swap_out_find (swap_id_t swap_idx)
+{
+  for (struct list_elem *e = list_begin (&swap_out_list);
+       e != list_end (&swap_out_list); e = list_next (e))
+    {
+      struct swap_out *w = list_entry (e, struct swap_out, elem);
+      if (w->first <= swap_idx && swap_idx < w->first + w->cnt)
+        return w;
+    }
+  return NULL;
 }
 
 /**
  * @brief free a block in swap table
  * @param swap_idx
+ * @note drops one reference; the slot is released with the last one
+ * @note a slot still being written is only released once the write
+ * completes, so its sectors are never written twice at the same time
  */
 void
 swap_free (swap_id_t swap_idx)
 {
   ASSERT (bitmap_all (swap_used_map, swap_idx, 1));
-  bitmap_set_multiple (swap_used_map, swap_idx, 1, false);
+  lock_acquire (&swap_lock);
+  ASSERT (swap_refs[swap_idx] > 0);
+  bool last = --swap_refs[swap_idx] == 0;
+  lock_release (&swap_lock);
+  if (!last)
+    return;
+
+  zswap_invalidate (swap_idx);
+  lock_acquire (&swap_lock);
+  struct swap_out *w = swap_out_find (swap_idx);
+  if (w != NULL)
+    w->freed[swap_idx - w->first] = true;
+  else
+    bitmap_set_multiple (swap_used_map, swap_idx, 1, false);
+  lock_release (&swap_lock);
+}
+
+/**
+ * @brief completion callback of an asynchronous swap-out
+ * @note runs in the swap device's worker thread
+ */
+static void
+swap_write_done (struct block_request *req UNUSED, void *w_)
+{
+  struct swap_out *w = w_;
+
+  lock_acquire (&swap_lock);
+  list_remove (&w->elem);
+  swap_out_cnt -= w->cnt;
+  for (size_t i = 0; i < w->cnt; i++)
+    if (w->freed[i])
+      bitmap_set_multiple (swap_used_map, w->first + i, 1, false);
+  lock_release (&swap_lock);
+
+  palloc_free_multiple (w->pages, w->cnt);
+  free (w);
+}
+
+/**
+ * @brief write pages to consecutive swap slots on disk
+ * @param pages the `cnt` source pages
+ * @param cnt the number of pages, at most SWAP_CLUSTER
+ * @param first the first of `cnt` allocated slots
+ * @note the pages are copied and written in the background with one
+ * transfer, so they may be reused at once; if too many writes are in flight
+ * or memory is short, writes synchronously instead
+ */
+static void
+swap_write_disk (void **pages, size_t cnt, swap_id_t first)
+{
+  struct swap_out *w = NULL;
+  lock_acquire (&swap_lock);
+  if (swap_out_cnt + cnt <= SWAP_OUT_MAX)
+    {
+      w = malloc (sizeof *w);
+      if (w != NULL)
+        {
+          w->pages = palloc_get_multiple (0, cnt);
+          if (w->pages == NULL)
+            {
+              free (w);
+              w = NULL;
+            }
+        }
+    }
+  if (w != NULL)
+    {
+      w->first = first;
+      w->cnt = cnt;
+      for (size_t i = 0; i < cnt; i++)
+        {
+          w->freed[i] = false;
+          memcpy (w->pages + i * PGSIZE, pages[i], PGSIZE);
+        }
+      list_push_back (&swap_out_list, &w->elem);
+      swap_out_cnt += cnt;
+    }
+  lock_release (&swap_lock);
+
+  if (w == NULL)
+    {
+      for (size_t i = 0; i < cnt; i++)
+        block_write_multiple (swap_device, (first + i) * BLOCK_PER_PAGE,
+                              BLOCK_PER_PAGE, pages[i]);
+      return;
+    }
+
+  block_request_init (&w->req, true, first * BLOCK_PER_PAGE,
+                      cnt * BLOCK_PER_PAGE, w->pages, swap_write_done, w);
+  block_submit (swap_device, &w->req);
+}
+
+/**
+ * @brief write a page dropped from the compressed pool to its slot
+ */
+static void
+swap_writeback (swap_id_t slot, void *page)
+{
+  swap_write_disk (&page, 1, slot);
 }
 
 /**
- * @brief write a page to swap
- * @param src the source page
- * @return block_selector in which the source page is written
+ * @brief store pages of consecutive swap slots
+ * @param pages the `cnt` source pages
+ * @param cnt the number of pages, at most SWAP_CLUSTER
+ * @param first the first of `cnt` allocated slots
+ * @note pages are kept compressed in memory when they compress well; the
+ * others are written to disk, each run of them with one transfer
  */
-swap_id_t
-swap_write (void *src)
+static void
+swap_write_run (void **pages, size_t cnt, swap_id_t first)
 {
-  swap_id_t swap_idx = swap_alloc ();
-  for (int i = 0; i < BLOCK_PER_PAGE; i++)
-    block_write (swap_device, swap_idx * BLOCK_PER_PAGE + i,
-                 src + i * BLOCK_SECTOR_SIZE);
-  return swap_idx;
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      if (zswap_store (first + i, pages[i]))
+        {
+          i++;
+          continue;
+        }
+
+      size_t run = 1;
+      while (i + run < cnt && !zswap_store (first + i + run, pages[i + run]))
+        run++;
+      swap_write_disk (pages + i, run, first + i);
+      i += run + 1;
+    }
+}
+
+/**
+ * @brief checksum of a page for the same-page index
+ */
+static uint32_t
+page_checksum (const void *page)
+{
+  const uint32_t *word = page;
+  uint32_t sum = 2166136261u;
+  for (size_t i = 0; i < PGSIZE / sizeof *word; i++)
+    sum = (sum ^ word[i]) * 16777619u;
+  return sum;
+}
+
+/**
+ * @brief whether the page stored in a slot equals `page`
+ * @note only looks at copies in memory, never reads the disk
+ */
+static bool
+swap_matches (swap_id_t slot, const void *page)
+{
+  bool same = false;
+
+  lock_acquire (&swap_lock);
+  struct swap_out *w = swap_out_find (slot);
+  if (w != NULL)
+    same = !memcmp (w->pages + (slot - w->first) * PGSIZE, page, PGSIZE);
+  lock_release (&swap_lock);
+
+  if (w == NULL)
+    {
+      void *buffer = palloc_get_page (0);
+      if (buffer != NULL)
+        {
+          same = zswap_load (slot, buffer) && !memcmp (buffer, page, PGSIZE);
+          palloc_free_page (buffer);
+        }
+    }
+  return same;
 }
 
 /**
- * @brief read a page from swap
- * @param swap_idx the index of the page to read
- * @param dst the buffer to store the page
+ * @brief find a slot already holding a copy of a page and reference it
+ * @param page the page to swap out
+ * @param sum its checksum
+ * @param id set to the shared slot
+ * @return true if the page shares a slot and needs no write
+ */
+static bool
+swap_share (const void *page, uint32_t sum, swap_id_t *id)
+{
+  struct share_entry *e = &share_table[sum % SHARE_SIZE];
+  swap_id_t slot = 0;
+  bool candidate;
+
+  lock_acquire (&swap_lock);
+  candidate = e->valid && e->sum == sum && swap_refs[e->slot] > 0
+              && swap_refs[e->slot] < UINT16_MAX;
+  if (candidate)
+    {
+      // hold the slot while comparing
+      slot = e->slot;
+      swap_refs[slot]++;
+    }
+  lock_release (&swap_lock);
+
+  if (!candidate)
+    return false;
+  if (!swap_matches (slot, page))
+    {
+      swap_free (slot);
+      return false;
+    }
+  *id = slot;
+  return true;
+}
+
+/**
+ * @brief write pages to swap, in consecutive slots where possible
+ * @param pages the `cnt` source pages
+ * @param cnt the number of pages, at most SWAP_CLUSTER
+ * @param ids set to the slot of each page
+ * @note pages evicted together are usually faulted back together, so
+ * keeping them next to each other lets swap_read_multiple() read them back
+ * with one transfer
+ * @note a page identical to one still in memory in the compressed pool or
+ * an in-flight write shares its slot instead of being written again
  */
 void
-swap_read (swap_id_t swap_idx, void *dst)
+swap_write_multiple (void **pages, size_t cnt, swap_id_t *ids)
 {
-  for (int i = 0; i < BLOCK_PER_PAGE; i++)
-    block_read (swap_device, swap_idx * BLOCK_PER_PAGE + i,
-                dst + i * BLOCK_SECTOR_SIZE);
+  void *unique[SWAP_CLUSTER];
+  size_t unique_idx[SWAP_CLUSTER];
+  uint32_t sums[SWAP_CLUSTER];
+  size_t unique_cnt = 0;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      sums[i] = page_checksum (pages[i]);
+      if (!swap_share (pages[i], sums[i], &ids[i]))
+        {
+          unique[unique_cnt] = pages[i];
+          unique_idx[unique_cnt++] = i;
+        }
+    }
+
+  for (size_t done = 0; done < unique_cnt;)
+    {
+      swap_id_t first;
+      size_t run = swap_alloc_run (unique_cnt - done, &first);
+
+      swap_write_run (unique + done, run, first);
+      lock_acquire (&swap_lock);
+      for (size_t i = 0; i < run; i++)
+        {
+          size_t idx = unique_idx[done + i];
+          struct share_entry *e = &share_table[sums[idx] % SHARE_SIZE];
+          ids[idx] = first + i;
+          e->valid = true;
+          e->sum = sums[idx];
+          e->slot = first + i;
+        }
+      lock_release (&swap_lock);
+      done += run;
+    }
+}
+
+/**
+ * @brief read pages from consecutive swap slots
+ * @param first the slot of the first page
+ * @param cnt the number of pages, at most SWAP_CLUSTER
+ * @param pages the `cnt` buffers to store the pages
+ * @note pages in the compressed pool are decompressed, and pages still
+ * being written are copied from memory; the others are read with one transfer if memory for a bounce buffer is
+ * available
+ */
+void
+swap_read_multiple (swap_id_t first, size_t cnt, void **pages)
+{
+  bool in_memory[SWAP_CLUSTER];
+  size_t disk_cnt = 0;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (size_t i = 0; i < cnt; i++)
+    in_memory[i] = zswap_load (first + i, pages[i]);
+
+  lock_acquire (&swap_lock);
+  for (size_t i = 0; i < cnt; i++)
+    {
+      if (in_memory[i])
+        continue;
+      struct swap_out *w = swap_out_find (first + i);
+      in_memory[i] = w != NULL;
+      if (w != NULL)
+        memcpy (pages[i], w->pages + (first + i - w->first) * PGSIZE, PGSIZE);
+      else
+        disk_cnt++;
+    }
+  lock_release (&swap_lock);
+
+  if (disk_cnt == 0)
+    return;
+
+  uint8_t *bounce = NULL;
+  if (disk_cnt == cnt && cnt > 1)
+    bounce = palloc_get_multiple (0, cnt);
+  if (bounce != NULL)
+    {
+      block_read_multiple (swap_device, first * BLOCK_PER_PAGE,
+                           cnt * BLOCK_PER_PAGE, bounce);
+      for (size_t i = 0; i < cnt; i++)
+        memcpy (pages[i], bounce + i * PGSIZE, PGSIZE);
+      palloc_free_multiple (bounce, cnt);
+      return;
+    }
+
+  for (size_t i = 0; i < cnt; i++)
+    if (!in_memory[i])
+      block_read_multiple (swap_device, (first + i) * BLOCK_PER_PAGE,
+                           BLOCK_PER_PAGE, pages[i]);
 }
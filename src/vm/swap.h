@@ -2,14 +2,20 @@
 #define VM_SWAP_H
 
 #include "devices/block.h"
+#include <stddef.h>
+
+/* Most pages written or read back with one swap transfer. */
+#define SWAP_CLUSTER 8
 
 void swap_init (void);
 
 typedef unsigned swap_id_t;
 
-swap_id_t swap_alloc (void);
+/* No swap slot. */
+#define SWAP_NONE ((swap_id_t) -1)
+
 void swap_free (swap_id_t);
-swap_id_t swap_write (void *);
-void swap_read (swap_id_t, void *);
+void swap_write_multiple (void **pages, size_t cnt, swap_id_t *ids);
+void swap_read_multiple (swap_id_t first, size_t cnt, void **pages);
 
-#endif /* vm/swap.h */
\ No newline at end of file
+#endif /* vm/swap.h */
@@ -0,0 +1,405 @@
+#include "vma.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "user/syscall.h"
+#include <debug.h>
+
+/* The regions of a thread are kept in an AVL tree ordered by
+   start address, rooted at thread->vma_root.  Regions never
+   overlap, so the region holding an address is the one with the
+   greatest start not above it, and every operation takes
+   O(log regions). */
+
+/* Pages mapped together with a faulting page of a region.  A power
+   of two, the window is aligned to its size. */
+#define FAULT_AROUND_PAGES 4
+
+/* Pages read into the buffer cache past the window when a region is
+   scanned sequentially.  Kept small, the buffer cache is small. */
+#define FAULT_AHEAD_PAGES 2
+
+static int
+vma_height (const struct vma *vma)
+{
+  return vma != NULL ? vma->height : 0;
+}
+
+static void
+vma_update (struct vma *vma)
+{
+  int left = vma_height (vma->left);
+  int right = vma_height (vma->right);
+  vma->height = 1 + (left > right ? left : right);
+}
+
+static struct vma *
+vma_rotate_right (struct vma *vma)
+{
+  struct vma *left = vma->left;
+  vma->left = left->right;
+  left->right = vma;
+  vma_update (vma);
+  vma_update (left);
+  return left;
+}
+
+static struct vma *
+vma_rotate_left (struct vma *vma)
+{
+  struct vma *right = vma->right;
+  vma->right = right->left;
+  right->left = vma;
+  vma_update (vma);
+  vma_update (right);
+  return right;
+}
+
+/**
+ * @brief Restores the AVL balance of a subtree whose children are balanced
+ * @return the new root of the subtree
+ */
+static struct vma *
+vma_balance (struct vma *vma)
+{
+  vma_update (vma);
+  int balance = vma_height (vma->left) - vma_height (vma->right);
+  if (balance > 1)
+    {
+      if (vma_height (vma->left->left) < vma_height (vma->left->right))
+        vma->left = vma_rotate_left (vma->left);
+      return vma_rotate_right (vma);
+    }
+  if (balance < -1)
+    {
+      if (vma_height (vma->right->right) < vma_height (vma->right->left))
+        vma->right = vma_rotate_right (vma->right);
+      return vma_rotate_left (vma);
+    }
+  return vma;
+}
+
+static struct vma *
+vma_tree_insert (struct vma *root, struct vma *vma)
+{
+  if (root == NULL)
+    {
+      vma->left = vma->right = NULL;
+      vma->height = 1;
+      return vma;
+    }
+  if (vma->start < root->start)
+    root->left = vma_tree_insert (root->left, vma);
+  else
+    root->right = vma_tree_insert (root->right, vma);
+  return vma_balance (root);
+}
+
+static struct vma *
+vma_tree_remove_min (struct vma *root, struct vma **min)
+{
+  if (root->left == NULL)
+    {
+      *min = root;
+      return root->right;
+    }
+  root->left = vma_tree_remove_min (root->left, min);
+  return vma_balance (root);
+}
+
+static struct vma *
+vma_tree_remove (struct vma *root, struct vma *vma)
+{
+  ASSERT (root != NULL);
+  if (vma->start < root->start)
+    root->left = vma_tree_remove (root->left, vma);
+  else if (vma->start > root->start)
+    root->right = vma_tree_remove (root->right, vma);
+  else
+    {
+      ASSERT (root == vma);
+      if (vma->left == NULL)
+        return vma->right;
+      if (vma->right == NULL)
+        return vma->left;
+      struct vma *min;
+      struct vma *right = vma_tree_remove_min (vma->right, &min);
+      min->left = vma->left;
+      min->right = right;
+      root = min;
+    }
+  return vma_balance (root);
+}
+
+/**
+ * @brief Finds the region of the current thread with the greatest start
+ * not above `addr`
+ */
+static struct vma *
+vma_floor (const void *addr)
+{
+  struct vma *best = NULL;
+  for (struct vma *vma = thread_current ()->vma_root; vma != NULL;)
+    if (vma->start <= addr)
+      {
+        best = vma;
+        vma = vma->right;
+      }
+    else
+      vma = vma->left;
+  return best;
+}
+
+/**
+ * @brief Finds the region of the current thread with the least start not
+ * below `addr`
+ */
+static struct vma *
+vma_ceil (const void *addr)
+{
+  struct vma *best = NULL;
+  for (struct vma *vma = thread_current ()->vma_root; vma != NULL;)
+    if (vma->start >= addr)
+      {
+        best = vma;
+        vma = vma->left;
+      }
+    else
+      vma = vma->right;
+  return best;
+}
+
+/**
+ * @brief Maps a region of a file into the current thread
+ * @param mmap_entry the mapping the region belongs to
+ * @param start first page of the region
+ * @param page_cnt number of pages
+ * @param file_offset offset of `start` in the file, page aligned
+ * @param read_bytes bytes read from the file, the rest of the region is zero
+ * @param writable writable or not
+ * @return the region, or NULL if it overlaps another one or memory is short
+ */
+struct vma *
+vma_create (struct mmap_entry *mmap_entry, void *start, size_t page_cnt,
+            uint32_t file_offset, uint32_t read_bytes, bool writable)
+{
+  ASSERT (pg_ofs (start) == 0);
+  ASSERT (page_cnt > 0);
+
+  void *end = start + page_cnt * PGSIZE;
+  if (vma_overlaps (start, end))
+    return NULL;
+
+  struct vma *vma = malloc (sizeof (struct vma));
+  if (vma == NULL)
+    return NULL;
+  vma->start = start;
+  vma->end = end;
+  vma->file_offset = file_offset;
+  vma->read_bytes = read_bytes;
+  vma->writable = writable;
+  vma->mmap_entry = mmap_entry;
+  vma->next_fault = start;
+  vma->advice = MADV_NORMAL;
+  list_push_back (&mmap_entry->vma_list, &vma->elem);
+
+  struct thread *cur = thread_current ();
+  cur->vma_root = vma_tree_insert (cur->vma_root, vma);
+  return vma;
+}
+
+/**
+ * @brief Unmaps a region of the current thread
+ * @note the pages already touched have frame table entries of their own
+ * in the mapping, which are destroyed separately
+ */
+void
+vma_destroy (struct vma *vma)
+{
+  struct thread *cur = thread_current ();
+  cur->vma_root = vma_tree_remove (cur->vma_root, vma);
+  list_remove (&vma->elem);
+  free (vma);
+}
+
+/**
+ * @brief Finds the region of the current thread holding `addr`
+ * @return the region, or NULL if `addr` is not in one
+ */
+struct vma *
+vma_find (const void *addr)
+{
+  struct vma *vma = vma_floor (addr);
+  return vma != NULL && addr < vma->end ? vma : NULL;
+}
+
+/**
+ * @brief Whether a region of the current thread overlaps [start, end)
+ */
+bool
+vma_overlaps (const void *start, const void *end)
+{
+  ASSERT (start < end);
+  struct vma *vma = vma_floor ((const uint8_t *)end - 1);
+  return vma != NULL && vma->end > start;
+}
+
+/**
+ * @brief Creates the frame table entry of a page of a region
+ * @param vma the region
+ * @param upage a page of the region without an entry yet
+ * @return the entry, not loaded yet
+ */
+struct fte *
+vma_attach_page (struct vma *vma, void *upage)
+{
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (vma->start <= upage && upage < vma->end);
+
+  uint32_t ofs = (uint8_t *)upage - (uint8_t *)vma->start;
+  uint32_t size = 0;
+  if (vma->read_bytes > ofs)
+    size = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs : PGSIZE;
+  return fte_attach_to_file (vma->mmap_entry->file, vma->file_offset + ofs,
+                             size, upage, vma->writable);
+}
+
+/**
+ * @brief Maps the pages around a faulting page of a region
+ * @param vma the region
+ * @param upage the faulting page, already mapped
+ * @note Every page of the aligned window around `upage` that can be mapped
+ * without eviction is, so that reading through a mapping traps once per
+ * window and takes the file system lock once.  When the fault is the one
+ * right after the previous window, the region is read sequentially and the
+ * pages after this window are read ahead without waiting for the disk.
+ */
+void
+vma_fault_around (struct vma *vma, void *upage)
+{
+  ASSERT (vma->start <= upage && upage < vma->end);
+
+  if (vma->advice == MADV_RANDOM)
+    return;
+
+  uintptr_t window = FAULT_AROUND_PAGES * PGSIZE;
+  uint8_t *start = (uint8_t *)((uintptr_t)upage & ~(window - 1));
+  uint8_t *end = start + window;
+  if (start < (uint8_t *)vma->start)
+    start = vma->start;
+  if (end > (uint8_t *)vma->end)
+    end = vma->end;
+
+  bool held = has_acquired_filesys ();
+  if (!held)
+    acquire_filesys ();
+
+  for (uint8_t *page = start; page < end; page += PGSIZE)
+    {
+      if (page == upage)
+        continue;
+      struct fte *fte = cur_frame_table_find (page);
+      if (fte == NULL)
+        fte = vma_attach_page (vma, page);
+      if (!fte_fault_around (fte))
+        break;
+    }
+
+  uint32_t ofs = end - (uint8_t *)vma->start;
+  bool sequential
+      = upage == vma->next_fault || vma->advice == MADV_SEQUENTIAL;
+  if (sequential && ofs < vma->read_bytes)
+    {
+      uint32_t size = vma->read_bytes - ofs;
+      if (size > FAULT_AHEAD_PAGES * PGSIZE)
+        size = FAULT_AHEAD_PAGES * PGSIZE;
+      file_prefetch (vma->mmap_entry->file, size, vma->file_offset + ofs);
+    }
+  vma->next_fault = end;
+
+  if (!held)
+    release_filesys ();
+
+  // a sequential scan will not come back, make the pages behind it the
+  // first victims of the clock
+  if (vma->advice == MADV_SEQUENTIAL)
+    {
+      uint8_t *page = start - (uint8_t *)vma->start >= (ptrdiff_t)window
+                          ? start - window
+                          : (uint8_t *)vma->start;
+      struct pagedir_batch batch;
+      pagedir_batch_init (&batch);
+      for (; page < start; page += PGSIZE)
+        pagedir_clear_accessed (thread_current ()->pagedir, page, &batch);
+      pagedir_batch_flush (&batch);
+    }
+}
+
+/**
+ * @brief Applies madvise() advice to the pages in [start, end)
+ * @note MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL apply to every region
+ * overlapping the range as a whole.  MADV_WILLNEED maps the file pages of
+ * the range while frames are free without eviction; MADV_DONTNEED writes
+ * back and drops them.  Anonymous memory is not affected.
+ */
+void
+vma_advise (void *start, void *end, int advice)
+{
+  ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+
+  if (advice == MADV_DONTNEED)
+    {
+      for (uint8_t *page = start; page < (uint8_t *)end; page += PGSIZE)
+        {
+          struct fte *fte = cur_frame_table_find (page);
+          if (fte != NULL)
+            fte_release (fte);
+        }
+      return;
+    }
+
+  bool held = has_acquired_filesys ();
+  if (advice == MADV_WILLNEED && !held)
+    acquire_filesys ();
+
+  struct vma *vma = vma_find (start);
+  if (vma == NULL)
+    vma = vma_ceil (start);
+  bool full = false;
+  for (; vma != NULL && vma->start < end && !full; vma = vma_ceil (vma->end))
+    if (advice != MADV_WILLNEED)
+      vma->advice = advice;
+    else
+      {
+        uint8_t *page = start > vma->start ? start : vma->start;
+        uint8_t *last = end < vma->end ? end : vma->end;
+        for (; page < last && !full; page += PGSIZE)
+          {
+            struct fte *fte = cur_frame_table_find (page);
+            if (fte == NULL)
+              fte = vma_attach_page (vma, page);
+            full = !fte_fault_around (fte);
+          }
+      }
+
+  if (advice == MADV_WILLNEED && !held)
+    release_filesys ();
+}
+
+/**
+ * @brief Writes the dirty pages of shared file mappings in [start, end)
+ * back to their files
+ */
+void
+vma_sync (void *start, void *end)
+{
+  for (uint8_t *page = start; page < (uint8_t *)end; page += PGSIZE)
+    {
+      struct fte *fte = cur_frame_table_find (page);
+      if (fte != NULL)
+        fte_sync (fte);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include "frame.h"
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A region of a process's address space mapped from a file.
+   Pages of a region get a frame table entry only when first
+   touched, so mapping costs one allocation however large the
+   region is. */
+struct vma
+{
+  void *start;                   // first page
+  void *end;                     // page after the last one
+  uint32_t file_offset;          // offset of `start` in the file
+  uint32_t read_bytes;           // bytes read from the file, the rest is zero
+  bool writable;                 // writable or not
+  struct mmap_entry *mmap_entry; // mapping of the file
+  struct list_elem elem;         // list element for mmap_entry->vma_list
+  void *next_fault;              // next fault of a sequential scan
+  int advice;                    // MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL
+
+  struct vma *left, *right; // children in the region tree
+  int height;               // height of the subtree
+};
+
+struct vma *vma_create (struct mmap_entry *mmap_entry, void *start,
+                        size_t page_cnt, uint32_t file_offset,
+                        uint32_t read_bytes, bool writable);
+void vma_destroy (struct vma *vma);
+struct vma *vma_find (const void *addr);
+bool vma_overlaps (const void *start, const void *end);
+struct fte *vma_attach_page (struct vma *vma, void *upage);
+void vma_fault_around (struct vma *vma, void *upage);
+void vma_advise (void *start, void *end, int advice);
+void vma_sync (void *start, void *end);
+
+#endif /* vm/vma.h */
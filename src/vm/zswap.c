@@ -0,0 +1,424 @@
+#include "zswap.h"
+#include "bitmap.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Compressed swap cache.
+
+   Pages written to swap are first compressed into a pool of
+   kernel pages, keyed by their swap slot, and only written to the
+   slot when the pool runs out of room, oldest first.  A fault on
+   a recently evicted page is then served by decompressing it
+   instead of reading the disk.  The slot stays allocated while
+   its page is in the pool, so that writing the page back never
+   fails. */
+
+/* Pool size in pages, allocated once at startup. */
+#define ZSWAP_POOL_PAGES 32
+
+/* The pool is handed out in chunks of this many bytes. */
+#define ZSWAP_CHUNK 64
+#define ZSWAP_CHUNK_CNT (ZSWAP_POOL_PAGES * PGSIZE / ZSWAP_CHUNK)
+
+/* Pages that do not compress to this size go straight to disk. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* A compressed page in the pool. */
+struct zswap_entry
+{
+  struct hash_elem hash_elem; /* Element in zswap_map. */
+  struct list_elem lru_elem;  /* Element in zswap_lru. */
+  swap_id_t slot;             /* Swap slot the page belongs to. */
+  size_t chunk;               /* First pool chunk. */
+  size_t size;                /* Compressed size in bytes. */
+  void *page;                 /* Decompressed page being written back to
+                                 its slot, or NULL while in the pool. */
+};
+
+static uint8_t *zswap_pool;           /* ZSWAP_POOL_PAGES pages. */
+static struct bitmap *zswap_chunks;   /* Used pool chunks. */
+static struct hash zswap_map;         /* Entries by slot. */
+static struct list zswap_lru;         /* Entries, oldest first. */
+static struct lock zswap_lock;        /* Protects the above. */
+static struct condition zswap_written; /* An entry's writeback ended. */
+static zswap_writeback_func *zswap_writeback;
+
+/* ---------------------------- LZ codec ---------------------------- */
+
+/* A small LZ77 codec in the spirit of LZ4.  The compressed stream
+   is a series of sequences, each a token byte whose high nibble is
+   a literal count and low nibble a match length minus LZ_MIN_MATCH
+   (15 meaning more length bytes follow, each adding up to 255),
+   then the literals, then a 2-byte little-endian match offset and
+   any extra length bytes.  The last sequence has literals only. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+/* Last position of each hashed 4-byte sequence, protected by
+   zswap_lock. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static uint32_t
+lz_read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+static unsigned
+lz_hash (uint32_t seq)
+{
+  return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief write an extended length
+ */
+static uint8_t *
+lz_put_length (uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/**
+ * @brief append one sequence
+ * @param op output position
+ * @param op_end end of the output buffer
+ * @param lit the literals
+ * @param lit_len the number of literals
+ * @param offset the match offset, ignored if `match_len` is 0
+ * @param match_len the match length, 0 for the last sequence
+ * @return the new output position, or NULL if the output is full
+ */
+static uint8_t *
+lz_put_sequence (uint8_t *op, uint8_t *op_end, const uint8_t *lit,
+                 size_t lit_len, size_t offset, size_t match_len)
+{
+  size_t ml = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+  if ((size_t)(op_end - op) < 1 + lit_len / 255 + 1 + lit_len + 2
+                                  + ml / 255 + 1)
+    return NULL;
+
+  *op++ = (lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15);
+  if (lit_len >= 15)
+    op = lz_put_length (op, lit_len - 15);
+  memcpy (op, lit, lit_len);
+  op += lit_len;
+
+  if (match_len > 0)
+    {
+      *op++ = offset & 0xff;
+      *op++ = offset >> 8;
+      if (ml >= 15)
+        op = lz_put_length (op, ml - 15);
+    }
+  return op;
+}
+
+/**
+ * @brief compress a page
+ * @param src the page
+ * @param dst receives the compressed page
+ * @param limit size of `dst`
+ * @return the compressed size, or 0 if it would exceed `limit`
+ */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t limit)
+{
+  const uint8_t *ip = src, *anchor = src, *end = src + PGSIZE;
+  uint8_t *op = dst, *op_end = dst + limit;
+
+  memset (lz_table, 0, sizeof lz_table);
+  while (ip + LZ_MIN_MATCH <= end)
+    {
+      uint32_t seq = lz_read32 (ip);
+      unsigned h = lz_hash (seq);
+      const uint8_t *ref = src + lz_table[h];
+
+      lz_table[h] = ip - src;
+      if (ref < ip && lz_read32 (ref) == seq)
+        {
+          size_t len = LZ_MIN_MATCH;
+          while (ip + len < end && ref[len] == ip[len])
+            len++;
+          op = lz_put_sequence (op, op_end, anchor, ip - anchor, ip - ref,
+                                len);
+          if (op == NULL)
+            return 0;
+          ip += len;
+          anchor = ip;
+        }
+      else
+        ip++;
+    }
+
+  op = lz_put_sequence (op, op_end, anchor, end - anchor, 0, 0);
+  return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+/**
+ * @brief read an extended length
+ */
+static const uint8_t *
+lz_get_length (const uint8_t *ip, size_t *len)
+{
+  uint8_t b;
+  do
+    {
+      b = *ip++;
+      *len += b;
+    }
+  while (b == 255);
+  return ip;
+}
+
+/**
+ * @brief decompress a page compressed by lz_compress
+ * @param src the compressed page
+ * @param size the compressed size
+ * @param dst receives the page
+ */
+static void
+lz_decompress (const uint8_t *src, size_t size, uint8_t *dst)
+{
+  const uint8_t *ip = src, *ip_end = src + size;
+  uint8_t *op = dst;
+
+  while (ip < ip_end)
+    {
+      unsigned token = *ip++;
+      size_t lit_len = token >> 4;
+      size_t match_len = token & 15;
+
+      if (lit_len == 15)
+        ip = lz_get_length (ip, &lit_len);
+      memcpy (op, ip, lit_len);
+      op += lit_len;
+      ip += lit_len;
+      if (ip >= ip_end)
+        break;
+
+      size_t offset = ip[0] | ip[1] << 8;
+      ip += 2;
+      if (match_len == 15)
+        ip = lz_get_length (ip, &match_len);
+      match_len += LZ_MIN_MATCH;
+
+      // byte by byte, the match may overlap its own output
+      const uint8_t *ref = op - offset;
+      while (match_len-- > 0)
+        *op++ = *ref++;
+    }
+  ASSERT (op == dst + PGSIZE);
+}
+
+/* ------------------------------ Pool ------------------------------ */
+
+static unsigned
+zswap_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct zswap_entry, hash_elem)->slot);
+}
+
+static bool
+zswap_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct zswap_entry, hash_elem)->slot
+         < hash_entry (b, struct zswap_entry, hash_elem)->slot;
+}
+
+/**
+ * @brief initialize the compressed swap cache
+ * @param writeback writes a page dropped from the pool to its slot
+ * @note if the pool cannot be allocated, every page goes to disk
+ */
+void
+zswap_init (zswap_writeback_func *writeback)
+{
+  lock_init (&zswap_lock);
+  cond_init (&zswap_written);
+  hash_init (&zswap_map, zswap_hash, zswap_less, NULL);
+  list_init (&zswap_lru);
+  zswap_writeback = writeback;
+
+  zswap_pool = palloc_get_multiple (0, ZSWAP_POOL_PAGES);
+  zswap_chunks = zswap_pool != NULL ? bitmap_create (ZSWAP_CHUNK_CNT) : NULL;
+}
+
+/**
+ * @brief find the entry of a slot
+ * @note zswap_lock must be held
+ */
+static struct zswap_entry *
+zswap_find (swap_id_t slot)
+{
+  struct zswap_entry key;
+  key.slot = slot;
+  struct hash_elem *e = hash_find (&zswap_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct zswap_entry, hash_elem) : NULL;
+}
+
+/**
+ * @brief release the pool chunks of an entry and unlink it from the LRU
+ * @note zswap_lock must be held
+ */
+static void
+zswap_unlink (struct zswap_entry *z)
+{
+  list_remove (&z->lru_elem);
+  bitmap_set_multiple (zswap_chunks, z->chunk,
+                       DIV_ROUND_UP (z->size, ZSWAP_CHUNK), false);
+}
+
+/**
+ * @brief write the oldest page of the pool to its slot and drop it
+ * @param buffer a page to decompress into
+ * @return false if the pool is empty
+ * @note zswap_lock must be held; it is released during the write, while
+ * the entry stays in zswap_map so that the slot's page is still loaded
+ * from `buffer` and the slot is not freed under the write
+ */
+static bool
+zswap_evict_oldest (void *buffer)
+{
+  if (list_empty (&zswap_lru))
+    return false;
+
+  struct zswap_entry *z
+      = list_entry (list_front (&zswap_lru), struct zswap_entry, lru_elem);
+  lz_decompress (zswap_pool + z->chunk * ZSWAP_CHUNK, z->size, buffer);
+  zswap_unlink (z);
+  z->page = buffer;
+  lock_release (&zswap_lock);
+
+  zswap_writeback (z->slot, buffer);
+
+  lock_acquire (&zswap_lock);
+  hash_delete (&zswap_map, &z->hash_elem);
+  free (z);
+  cond_broadcast (&zswap_written, &zswap_lock);
+  return true;
+}
+
+/**
+ * @brief compress a page into the pool
+ * @param slot the swap slot allocated for the page
+ * @param page the page
+ * @return true if the page was stored, false if it must be written to its
+ * slot instead because it does not compress well or memory is short
+ * @note makes room by writing the oldest pages of the pool to their slots
+ */
+bool
+zswap_store (swap_id_t slot, const void *page)
+{
+  if (zswap_pool == NULL)
+    return false;
+
+  struct zswap_entry *z = malloc (sizeof *z);
+  uint8_t *buffer = palloc_get_page (0);
+  if (z == NULL || buffer == NULL)
+    {
+      free (z);
+      palloc_free_page (buffer);
+      return false;
+    }
+
+  lock_acquire (&zswap_lock);
+  size_t size = lz_compress (page, buffer, ZSWAP_MAX_SIZE);
+  size_t chunk = BITMAP_ERROR;
+  if (size != 0)
+    {
+      size_t chunk_cnt = DIV_ROUND_UP (size, ZSWAP_CHUNK);
+      uint8_t *scratch = NULL;
+      while ((chunk = bitmap_scan_and_flip (zswap_chunks, 0, chunk_cnt, false))
+             == BITMAP_ERROR)
+        {
+          if (scratch == NULL && (scratch = palloc_get_page (0)) == NULL)
+            break;
+          if (!zswap_evict_oldest (scratch))
+            break;
+        }
+      palloc_free_page (scratch);
+    }
+  if (chunk != BITMAP_ERROR)
+    {
+      z->slot = slot;
+      z->chunk = chunk;
+      z->size = size;
+      z->page = NULL;
+      memcpy (zswap_pool + chunk * ZSWAP_CHUNK, buffer, size);
+      hash_insert (&zswap_map, &z->hash_elem);
+      list_push_back (&zswap_lru, &z->lru_elem);
+    }
+  lock_release (&zswap_lock);
+
+  palloc_free_page (buffer);
+  if (chunk == BITMAP_ERROR)
+    {
+      free (z);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * @brief decompress the page of a slot from the pool
+ * @param slot the swap slot
+ * @param page receives the page
+ * @return false if the page is not in the pool
+ * @note the page stays in the pool until zswap_invalidate()
+ */
+bool
+zswap_load (swap_id_t slot, void *page)
+{
+  if (zswap_pool == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  struct zswap_entry *z = zswap_find (slot);
+  if (z != NULL && z->page != NULL)
+    memcpy (page, z->page, PGSIZE);
+  else if (z != NULL)
+    lz_decompress (zswap_pool + z->chunk * ZSWAP_CHUNK, z->size, page);
+  lock_release (&zswap_lock);
+  return z != NULL;
+}
+
+/**
+ * @brief drop the page of a freed slot from the pool, if it is there
+ * @param slot the swap slot
+ * @note waits for a writeback of the page to be handed to the swap
+ * device, so that the caller sees the write in flight
+ */
+void
+zswap_invalidate (swap_id_t slot)
+{
+  if (zswap_pool == NULL)
+    return;
+
+  lock_acquire (&zswap_lock);
+  struct zswap_entry *z;
+  while ((z = zswap_find (slot)) != NULL && z->page != NULL)
+    cond_wait (&zswap_written, &zswap_lock);
+  if (z != NULL)
+    {
+      hash_delete (&zswap_map, &z->hash_elem);
+      zswap_unlink (z);
+      free (z);
+    }
+  lock_release (&zswap_lock);
+}
@@ -0,0 +1,15 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include "swap.h"
+#include <stdbool.h>
+
+/* Writes a page dropped from the compressed pool to its swap slot. */
+typedef void zswap_writeback_func (swap_id_t, void *page);
+
+void zswap_init (zswap_writeback_func *);
+bool zswap_store (swap_id_t, const void *page);
+bool zswap_load (swap_id_t, void *page);
+void zswap_invalidate (swap_id_t);
+
+#endif /* vm/zswap.h */